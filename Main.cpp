@@ -1,22 +1,83 @@
-﻿#include <glad/glad.h>
+﻿#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MESH_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/hash.hpp>
 #include <iostream>
 #include <vector>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <charconv>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
 
 
 
-// Vertex structure
+// Vertex structure. Colors are unorm8 like in the compact formats, so
+// uncolored models pay 4 bytes for the white default instead of 12.
 struct Vertex {
     glm::vec3 position;
     glm::vec3 normal;
+    uint32_t color = 0xffffffffu;
+    glm::vec3 faceNormal;             // set on provoking vertices, read by flat shading
+};
+static_assert(sizeof(Vertex) == 40, "Vertex must be tightly packed");
+
+// Render vertex in the compact formats (20 bytes instead of 40): unorm16
+// positions inside the quantization box, normals as octahedral snorm16x2 or
+// snorm 10_10_10_2, unorm8 colors
+struct CompactVertex {
+    glm::u16vec3 position;
+    uint16_t padding = 0;
+    uint32_t normal;
+    uint32_t faceNormal;
+    uint32_t color;
 };
+static_assert(sizeof(CompactVertex) == 20, "CompactVertex must be tightly packed");
 
 // Triangle structure
 struct Triangle {
@@ -24,11 +85,67 @@ struct Triangle {
     glm::vec3 faceNormal;
 };
 
-// Model data
+// Vertex-to-corner adjacency in CSR form: the corners around vertex v are
+// corners[offsets[v]] .. corners[offsets[v + 1] - 1], each stored as
+// face * 3 + corner and sorted by face
+struct VertexAdjacency {
+    std::vector<size_t> offsets;
+    std::vector<unsigned int> corners;
+};
+
+// Mesh arrays produced by the loaders
+struct MeshData {
+    std::vector<glm::vec3> positions;
+    std::vector<Triangle> triangles;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec3> colors;        // per vertex, empty if the file has none
+    std::vector<glm::vec3> faceColors;    // per triangle, empty if the file has none
+    bool hasFaceNormals = false;          // triangles already carry face normals from the file
+    VertexAdjacency adjacency;            // built with the vertex normals, empty otherwise
+    bool normalsPending = false;          // normals are left to the GPU pass (--gpu-normals)
+    glm::vec3 center = glm::vec3(0.0f);
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+};
+
+// Index layout for drawing shared vertices. Slots below the vertex count are
+// the model's vertices; slots past it duplicate a vertex for a face whose
+// corners all provoke other faces already. provokingIndices rotates every
+// face so that its last corner, GL's default provoking vertex, is a slot no
+// other face ends on, which is where flat attributes (face normal, face
+// color) are stored.
+const unsigned int NO_FACE = 0xffffffffu;
+
+// Vertex index the loaders store for a reference that cannot be valid (OBJ
+// index 0, negative PLY indices); loadModel drops the faces using it
+const unsigned int INVALID_VERTEX = 0xffffffffu;
+
+struct RenderLayout {
+    std::vector<unsigned int> provokingIndices;
+    std::vector<unsigned int> duplicateSources;   // model vertex of each slot past the vertex count
+    std::vector<unsigned int> provokedFace;       // face whose last corner is the slot, or NO_FACE
+    std::vector<unsigned int> nextDuplicate;      // next slot of the same model vertex, or NO_FACE
+    bool valid = false;
+};
+
+// Model data. The render vertices (vertices, or compactVertices in the
+// compact formats) serve every shading mode; the smooth modes draw
+// smoothIndices and flat shading flatIndices over them.
 std::vector<Vertex> vertices;
+std::vector<CompactVertex> compactVertices;
+glm::vec3 quantizationMin(0.0f);
+glm::vec3 quantizationScale(1.0f);
+std::vector<unsigned int> smoothIndices;
+std::vector<unsigned int> flatIndices;
+RenderLayout renderLayout;
 std::vector<Triangle> triangles;
 std::vector<glm::vec3> vertexPositions;
 std::vector<glm::vec3> vertexNormals;
+std::vector<glm::vec3> vertexColors;
+std::vector<glm::vec3> faceColors;
+VertexAdjacency vertexAdjacency;
+glm::vec3 modelBoundsMin(0.0f);
+glm::vec3 modelBoundsMax(0.0f);
 
 // Camera parameters
 float cameraAngle = 45.0f;    // ← начальный угол
@@ -40,6 +157,7 @@ glm::vec3 modelCenter(0.0f);
 float lightAngle = 45.0f;
 float lightRadius = 2.0f;
 float lightHeight = 2.0f;
+const int SCENE_LIGHT_COUNT = 2;    // orbiting light and headlight
 
 // Projection mode
 bool usePerspective = true;
@@ -50,332 +168,4541 @@ int shadingMode = 2;  // ← начинаем с Phong shading
 // Material index
 int currentMaterial = 0;
 
+// Loader mode (true: memory-mapped parser, false: getline/istringstream)
+bool useMappedLoader = true;
+
+// Binary mesh cache (.smfb); empty directory means next to the source file
+bool useMeshCache = true;
+std::string meshCacheDir;
+
+// Linked shader programs cached on disk as driver binaries
+bool useShaderCache = true;
+
+// Load-time vertex welding and compaction (epsilon 0: exact duplicates only)
+bool useWelding = false;
+float weldEpsilon = 0.0f;
+
+// Load-time reordering of faces for the post-transform vertex cache and of
+// vertices for fetch locality, tuned for a FIFO cache of this many vertices
+bool useReordering = false;
+unsigned int vertexCacheSize = 16;
+const unsigned int MIN_VERTEX_CACHE_SIZE = 3;
+const unsigned int MAX_VERTEX_CACHE_SIZE = 256;
+
+// Write the loaded model in the quantized .smfq format to this path
+std::string quantizedExportPath;
+
+// Progressive load: open the window first and stream faces to the GPU
+bool useStreamingLoad = false;
+
+// Worker threads for parsing and normal generation (0: all cores)
+unsigned int workerThreadCount = 0;
+const unsigned int MAX_WORKER_THREADS = 256;
+
+// Widest SIMD kernels to use; the CPU is checked at runtime on top of this
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE,
+    SIMD_AVX2
+};
+SimdLevel maxSimdLevel = SIMD_AVX2;
+
+// How face normals are weighted when averaged into vertex normals
+enum NormalWeighting {
+    WEIGHT_UNIFORM,
+    WEIGHT_AREA,
+    WEIGHT_ANGLE
+};
+NormalWeighting normalWeighting = WEIGHT_UNIFORM;
+
+// Generate normals on the GPU with transform feedback, optionally checking
+// them against the CPU result
+bool useGpuNormals = false;
+bool validateGpuNormals = false;
+bool normalsPending = false;
+
+// Set by the N key: load the next model given on the command line
+bool nextModelRequested = false;
+
+// Set by the B key: push a random patch of the surface outwards
+bool sculptRequested = false;
+
+// Vertex buffer layout: full floats, or compact with octahedral or
+// 10_10_10_2 normals
+enum VertexFormat {
+    VERTEX_FLOAT,
+    VERTEX_OCTAHEDRAL,
+    VERTEX_PACKED
+};
+VertexFormat vertexFormat = VERTEX_FLOAT;
+
+// Reload the model when its file changes on disk
+bool watchModelFile = true;
+
 // Window dimensions
 int windowWidth = 1200;
 int windowHeight = 800;
 
-// Shader sources
-const char* flatVertexShaderSource = R"(
-#version 330 core
+// Shader sources. The shading programs are variants of one vertex and one
+// fragment template, specialized by the #defines that shaderVariantSource
+// puts in front (see ShaderKey):
+//   SHADING             SHADING_FLAT, SHADING_GOURAUD or SHADING_PHONG
+//   LIGHT_COUNT         lights used, at most MAX_LIGHTS
+//   COMPACT_POSITIONS   positions normalized inside the quantization box
+//   OCTAHEDRAL_NORMALS  normals as two octahedral components
+//   COLOR_SOURCE        COLOR_NONE, COLOR_VERTEX (interpolated) or COLOR_FACE
+//                       (flat, from the provoking vertex)
+
+// Declarations shared by both stages
+const char* shaderCommonSource = R"(
+#define SHADING_FLAT 0
+#define SHADING_GOURAUD 1
+#define SHADING_PHONG 2
+#define COLOR_NONE 0
+#define COLOR_VERTEX 1
+#define COLOR_FACE 2
+
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 model;
+    mat4 modelViewProjection;
+    mat4 normalMatrix;
+    vec4 viewPos;
+};
+
+layout (std140) uniform Lights {
+    vec4 lightPositions[MAX_LIGHTS];
+    vec4 light_ambient;
+    vec4 light_diffuse;
+    vec4 light_specular;
+};
+
+layout (std140) uniform Material {
+    vec4 material_ambient;
+    vec4 material_diffuse;
+    vec4 material_specular;
+    float material_shininess;
+};
+
+// Ambient and diffuse light (to be multiplied by the base color) and specular
+// light at a surface point
+void shade(vec3 position, vec3 normal, out vec4 lighting, out vec4 specular)
+{
+    vec3 viewDir = normalize(viewPos.xyz - position);
+    lighting = light_ambient * material_ambient;
+    specular = vec4(0.0);
+    for (int i = 0; i < LIGHT_COUNT; i++) {
+        vec3 lightDir = normalize(lightPositions[i].xyz - position);
+        float diff = max(dot(normal, lightDir), 0.0);
+        lighting += light_diffuse * (diff * material_diffuse);
+
+        vec3 reflectDir = reflect(-lightDir, normal);
+        float spec = pow(max(dot(viewDir, reflectDir), 0.0), material_shininess);
+        specular += light_specular * (spec * material_specular);
+    }
+}
+
+#if SHADING == SHADING_FLAT
+#define SHADING_INTERPOLATION flat
+#else
+#define SHADING_INTERPOLATION smooth
+#endif
+
+#if COLOR_SOURCE == COLOR_FACE
+#define COLOR_INTERPOLATION flat
+#else
+#define COLOR_INTERPOLATION smooth
+#endif
+)";
+
+const char* shadingVertexShaderSource = R"(
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec3 aColor;
+layout (location = 3) in vec3 aFaceNormal;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#if COMPACT_POSITIONS
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+#endif
+
+vec3 decodeNormal(vec3 n)
+{
+#if OCTAHEDRAL_NORMALS
+    vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+    float t = max(-v.z, 0.0);
+    v.xy += vec2(v.x >= 0.0 ? -t : t, v.y >= 0.0 ? -t : t);
+    return normalize(v);
+#else
+    return n;
+#endif
+}
 
 out vec3 FragPos;
-out vec3 Normal;
+SHADING_INTERPOLATION out vec3 Normal;
+#if COLOR_SOURCE != COLOR_NONE
+COLOR_INTERPOLATION out vec3 Color;
+#endif
+#if SHADING == SHADING_GOURAUD
+// Lighting without the base color, which is applied per fragment so face
+// colors can come from the provoking vertex
+out vec4 lighting;
+out vec4 specular;
+#endif
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+#if COMPACT_POSITIONS
+    vec4 position = vec4(positionOffset + positionScale * aPos, 1.0);
+#else
+    vec4 position = vec4(aPos, 1.0);
+#endif
+    FragPos = vec3(model * position);
+#if SHADING == SHADING_FLAT
+    Normal = mat3(normalMatrix) * decodeNormal(aFaceNormal);
+#else
+    Normal = mat3(normalMatrix) * decodeNormal(aNormal);
+#endif
+#if SHADING == SHADING_GOURAUD
+    shade(FragPos, normalize(Normal), lighting, specular);
+#endif
+#if COLOR_SOURCE != COLOR_NONE
+    Color = aColor;
+#endif
+    gl_Position = modelViewProjection * position;
 }
 )";
 
-const char* flatFragmentShaderSource = R"(
-#version 330 core
-in vec3 Normal;
+const char* shadingFragmentShaderSource = R"(
+in vec3 FragPos;
+SHADING_INTERPOLATION in vec3 Normal;
+#if COLOR_SOURCE != COLOR_NONE
+COLOR_INTERPOLATION in vec3 Color;
+#endif
+#if SHADING == SHADING_GOURAUD
+in vec4 lighting;
+in vec4 specular;
+#endif
 out vec4 FragColor;
 
-void main()
-{
-    vec3 color = abs(normalize(Normal));
-    FragColor = vec4(color, 1.0);
+void main()
+{
+#if COLOR_SOURCE != COLOR_NONE
+    vec4 baseColor = vec4(Color, 1.0);
+#else
+    vec4 baseColor = vec4(1.0);
+#endif
+
+#if SHADING == SHADING_FLAT
+#if COLOR_SOURCE != COLOR_NONE
+    FragColor = baseColor;
+#else
+    // Without colors flat shading shows the face normal
+    FragColor = vec4(abs(normalize(Normal)), 1.0);
+#endif
+#elif SHADING == SHADING_GOURAUD
+    FragColor = lighting * baseColor + specular;
+#else
+    vec4 lighting, specular;
+    shade(FragPos, normalize(Normal), lighting, specular);
+    FragColor = lighting * baseColor + specular;
+#endif
+}
+)";
+
+// GPU normal generation. The passes run as GL_POINTS with rasterization
+// discarded and read the mesh from texture buffers: positions as 3 floats per
+// vertex, the Triangle array as 6 uints per face (3 indices, 3 normal floats).
+const char* faceNormalShaderSource = R"(
+#version 330 core
+uniform samplerBuffer positions;
+uniform usamplerBuffer triangles;
+
+out vec3 faceNormal;
+
+vec3 cornerPosition(int face, int corner)
+{
+    int index = int(texelFetch(triangles, face * 6 + corner).r);
+    return vec3(texelFetch(positions, index * 3).r, texelFetch(positions, index * 3 + 1).r, texelFetch(positions, index * 3 + 2).r);
+}
+
+void main()
+{
+    vec3 p0 = cornerPosition(gl_VertexID, 0);
+    vec3 p1 = cornerPosition(gl_VertexID, 1);
+    vec3 p2 = cornerPosition(gl_VertexID, 2);
+    faceNormal = normalize(cross(p1 - p0, p2 - p0));
+}
+)";
+
+// One vertex per mesh vertex: gather the face normals of its corners through
+// the CSR adjacency, weighted like cornerWeight on the CPU
+const char* vertexNormalShaderSource = R"(
+#version 330 core
+uniform samplerBuffer positions;
+uniform usamplerBuffer triangles;
+uniform samplerBuffer faceNormals;
+uniform usamplerBuffer offsets;
+uniform usamplerBuffer corners;
+uniform int weighting;
+
+out vec3 vertexNormal;
+
+vec3 cornerPosition(int face, int corner)
+{
+    int index = int(texelFetch(triangles, face * 6 + corner).r);
+    return vec3(texelFetch(positions, index * 3).r, texelFetch(positions, index * 3 + 1).r, texelFetch(positions, index * 3 + 2).r);
+}
+
+float cornerWeight(int face, int corner)
+{
+    if (weighting == 0) return 1.0;
+    vec3 p = cornerPosition(face, corner);
+    vec3 a = cornerPosition(face, (corner + 1) % 3) - p;
+    vec3 b = cornerPosition(face, (corner + 2) % 3) - p;
+    if (weighting == 1) return 0.5 * length(cross(a, b));
+    float lengths = length(a) * length(b);
+    return lengths > 0.0 ? acos(clamp(dot(a, b) / lengths, -1.0, 1.0)) : 0.0;
+}
+
+void main()
+{
+    int first = int(texelFetch(offsets, gl_VertexID).r);
+    int last = int(texelFetch(offsets, gl_VertexID + 1).r);
+    vec3 sum = vec3(0.0);
+    for (int k = first; k < last; k++) {
+        int corner = int(texelFetch(corners, k).r);
+        int face = corner / 3;
+        float weight = cornerWeight(face, corner - face * 3);
+        if (weight > 0.0) {
+            sum += weight * vec3(texelFetch(faceNormals, face * 3).r, texelFetch(faceNormals, face * 3 + 1).r,
+                texelFetch(faceNormals, face * 3 + 2).r);
+        }
+    }
+    vertexNormal = normalize(sum);
+}
+)";
+
+// One vertex per render slot: copy the uploaded render vertex and fill in the
+// normal of its model vertex and, on provoking slots, its face's normal. The
+// record is captured as Vertex (10 words) or CompactVertex (the first 5),
+// with compact normals packed like packNormal.
+const char* renderNormalShaderSource = R"(
+#version 330 core
+uniform usamplerBuffer renderVertices;
+uniform usamplerBuffer duplicateSources;
+uniform usamplerBuffer provokedFaces;
+uniform samplerBuffer faceNormals;
+uniform samplerBuffer vertexNormals;
+uniform int vertexCount;
+uniform int format;         // VertexFormat
+
+flat out uvec4 words0to3;
+flat out uint word4;
+flat out uvec4 words5to8;
+flat out uint word9;
+
+vec3 fetchVec3(samplerBuffer data, int index)
+{
+    return vec3(texelFetch(data, index * 3).r, texelFetch(data, index * 3 + 1).r, texelFetch(data, index * 3 + 2).r);
+}
+
+uint packSnorm(float value, float scale, uint mask)
+{
+    return uint(int(round(clamp(value, -1.0, 1.0) * scale))) & mask;
+}
+
+uint packNormal(vec3 n)
+{
+    if (!(dot(n, n) > 0.0)) {
+        return 0u;
+    }
+    if (format == 1) {
+        n /= abs(n.x) + abs(n.y) + abs(n.z);
+        vec2 p = n.xy;
+        if (n.z < 0.0) {
+            p = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        }
+        return packSnorm(p.x, 32767.0, 0xffffu) | (packSnorm(p.y, 32767.0, 0xffffu) << 16);
+    }
+    return packSnorm(n.x, 511.0, 0x3ffu) | (packSnorm(n.y, 511.0, 0x3ffu) << 10) | (packSnorm(n.z, 511.0, 0x3ffu) << 20);
+}
+
+void main()
+{
+    int slot = gl_VertexID;
+    int source = slot < vertexCount ? slot : int(texelFetch(duplicateSources, slot - vertexCount).r);
+    uint face = texelFetch(provokedFaces, slot).r;
+    vec3 normal = fetchVec3(vertexNormals, source);
+    vec3 faceNormal = face != 0xffffffffu ? fetchVec3(faceNormals, int(face)) : vec3(0.0);
+
+    if (format == 0) {
+        int base = slot * 10;
+        words0to3 = uvec4(texelFetch(renderVertices, base).r, texelFetch(renderVertices, base + 1).r,
+            texelFetch(renderVertices, base + 2).r, floatBitsToUint(normal.x));
+        word4 = floatBitsToUint(normal.y);
+        words5to8 = uvec4(floatBitsToUint(normal.z), texelFetch(renderVertices, base + 6).r,
+            floatBitsToUint(faceNormal.x), floatBitsToUint(faceNormal.y));
+        word9 = floatBitsToUint(faceNormal.z);
+    }
+    else {
+        int base = slot * 5;
+        words0to3 = uvec4(texelFetch(renderVertices, base).r, texelFetch(renderVertices, base + 1).r,
+            packNormal(normal), packNormal(faceNormal));
+        word4 = texelFetch(renderVertices, base + 4).r;
+        words5to8 = uvec4(0u);
+        word9 = 0u;
+    }
+}
+)";
+
+// Shadow of the main context's bindings and capabilities. Calls that would
+// not change the state are filtered out, and issued and filtered calls are
+// counted per frame. Objects must be deleted through it too, so that a name
+// reused after a delete is not taken for the binding still cached. The
+// uploader thread's context has state of its own and binds directly.
+struct GLStateCache {
+    static const int BUFFER_TARGETS = 6;
+    static const int TEXTURE_UNITS = 8;
+    static const int TEXTURE_TARGETS = 2;
+    static const int CAPABILITIES = 3;
+
+    unsigned int program = 0;
+    unsigned int vertexArray = 0;
+    unsigned int buffers[BUFFER_TARGETS] = {};
+    unsigned int activeUnit = 0;
+    unsigned int textures[TEXTURE_UNITS][TEXTURE_TARGETS] = {};
+    unsigned int enabled[CAPABILITIES] = {};
+
+    size_t issued = 0;          // calls made this frame
+    size_t filtered = 0;        // calls skipped this frame
+    size_t lastIssued = 0;
+    size_t lastFiltered = 0;
+    size_t totalIssued = 0;
+    size_t totalFiltered = 0;
+
+    // Cached slot of a binding target, or -1 for state that is not tracked
+    // (element array bindings belong to the bound VAO)
+    static int bufferSlot(GLenum target) {
+        switch (target) {
+        case GL_ARRAY_BUFFER: return 0;
+        case GL_COPY_READ_BUFFER: return 1;
+        case GL_COPY_WRITE_BUFFER: return 2;
+        case GL_UNIFORM_BUFFER: return 3;
+        case GL_TEXTURE_BUFFER: return 4;
+        case GL_TRANSFORM_FEEDBACK_BUFFER: return 5;
+        default: return -1;
+        }
+    }
+
+    static int textureSlot(GLenum target) {
+        switch (target) {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_BUFFER: return 1;
+        default: return -1;
+        }
+    }
+
+    static int capabilitySlot(GLenum capability) {
+        switch (capability) {
+        case GL_DEPTH_TEST: return 0;
+        case GL_CULL_FACE: return 1;
+        case GL_RASTERIZER_DISCARD: return 2;
+        default: return -1;
+        }
+    }
+
+    // Record a call that sets cached to value; false if it can be skipped
+    bool change(unsigned int* cached, unsigned int value) {
+        if (cached && *cached == value) {
+            filtered++;
+            return false;
+        }
+        if (cached) *cached = value;
+        issued++;
+        return true;
+    }
+
+    void useProgram(unsigned int id) {
+        if (change(&program, id)) glUseProgram(id);
+    }
+
+    void bindVertexArray(unsigned int id) {
+        if (change(&vertexArray, id)) glBindVertexArray(id);
+    }
+
+    void bindBuffer(GLenum target, unsigned int id) {
+        int slot = bufferSlot(target);
+        if (change(slot < 0 ? nullptr : &buffers[slot], id)) glBindBuffer(target, id);
+    }
+
+    // Indexed binds also set the generic binding point
+    void bindBufferBase(GLenum target, unsigned int index, unsigned int id) {
+        int slot = bufferSlot(target);
+        if (slot >= 0) buffers[slot] = id;
+        issued++;
+        glBindBufferBase(target, index, id);
+    }
+
+    void bindBufferRange(GLenum target, unsigned int index, unsigned int id, GLintptr offset, GLsizeiptr size) {
+        int slot = bufferSlot(target);
+        if (slot >= 0) buffers[slot] = id;
+        issued++;
+        glBindBufferRange(target, index, id, offset, size);
+    }
+
+    void activeTexture(unsigned int unit) {
+        if (change(&activeUnit, unit)) glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    void bindTexture(GLenum target, unsigned int id) {
+        int slot = textureSlot(target);
+        bool tracked = slot >= 0 && activeUnit < TEXTURE_UNITS;
+        if (change(tracked ? &textures[activeUnit][slot] : nullptr, id)) glBindTexture(target, id);
+    }
+
+    void enable(GLenum capability) {
+        int slot = capabilitySlot(capability);
+        if (change(slot < 0 ? nullptr : &enabled[slot], 1)) glEnable(capability);
+    }
+
+    void disable(GLenum capability) {
+        int slot = capabilitySlot(capability);
+        if (change(slot < 0 ? nullptr : &enabled[slot], 0)) glDisable(capability);
+    }
+
+    // Deleting a bound object unbinds it
+    void deleteBuffers(int count, const unsigned int* ids) {
+        for (int i = 0; i < count; i++) {
+            for (unsigned int& buffer : buffers) {
+                if (buffer == ids[i]) buffer = 0;
+            }
+        }
+        glDeleteBuffers(count, ids);
+    }
+
+    void deleteVertexArrays(int count, const unsigned int* ids) {
+        for (int i = 0; i < count; i++) {
+            if (vertexArray == ids[i]) vertexArray = 0;
+        }
+        glDeleteVertexArrays(count, ids);
+    }
+
+    void deleteTextures(int count, const unsigned int* ids) {
+        for (int i = 0; i < count; i++) {
+            for (auto& unit : textures) {
+                for (unsigned int& texture : unit) {
+                    if (texture == ids[i]) texture = 0;
+                }
+            }
+        }
+        glDeleteTextures(count, ids);
+    }
+
+    void deleteProgram(unsigned int id) {
+        if (program == id) program = 0;
+        glDeleteProgram(id);
+    }
+
+    void endFrame() {
+        lastIssued = issued;
+        lastFiltered = filtered;
+        totalIssued += issued;
+        totalFiltered += filtered;
+        issued = 0;
+        filtered = 0;
+    }
+};
+
+GLStateCache glState;
+
+// Uniform blocks of the shading programs, mirrored with std140 layout: vec4
+// and mat4 members only, so no member needs padding. Each block has a fixed
+// binding point, set on every program that declares it.
+enum UniformBlock {
+    FRAME_BLOCK,
+    LIGHTS_BLOCK,
+    MATERIAL_BLOCK,
+    UNIFORM_BLOCK_COUNT
+};
+
+const char* uniformBlockNames[UNIFORM_BLOCK_COUNT] = { "Frame", "Lights", "Material" };
+
+// Camera and model transforms; the MVP and normal matrix are computed once
+// per frame here instead of per vertex in the shaders
+struct FrameBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::mat4 model;
+    glm::mat4 modelViewProjection;
+    glm::mat4 normalMatrix;     // upper 3x3 used
+    glm::vec4 viewPos;
+};
+
+// Size of the light array in the Lights block; variants use the first
+// LIGHT_COUNT entries
+const int MAX_LIGHTS = 4;
+
+struct LightsBlock {
+    glm::vec4 positions[MAX_LIGHTS];
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+};
+
+struct MaterialBlock {
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+    float shininess;
+    float padding[3];
+};
+
+static_assert(sizeof(FrameBlock) == 400, "FrameBlock must match the std140 Frame block");
+static_assert(sizeof(LightsBlock) == (MAX_LIGHTS + 3) * 16, "LightsBlock must match the std140 Lights block");
+static_assert(sizeof(MaterialBlock) == 64, "MaterialBlock must match the std140 Material block");
+
+const MaterialBlock materials[3] = {
+    // Bright specular material (required)
+    { glm::vec4(0.6f, 0.2f, 0.2f, 1.0f), glm::vec4(0.9f, 0.1f, 0.1f, 1.0f), glm::vec4(0.8f, 0.8f, 0.8f, 1.0f), 80.0f, {} },
+    // Gold-like material
+    { glm::vec4(0.24725f, 0.1995f, 0.0745f, 1.0f), glm::vec4(0.75164f, 0.60648f, 0.22648f, 1.0f),
+      glm::vec4(0.628281f, 0.555802f, 0.366065f, 1.0f), 51.2f, {} },
+    // Emerald-like material
+    { glm::vec4(0.0215f, 0.1745f, 0.0215f, 1.0f), glm::vec4(0.07568f, 0.61424f, 0.07568f, 1.0f),
+      glm::vec4(0.633f, 0.727811f, 0.633f, 1.0f), 76.8f, {} },
+};
+
+// All three blocks in one buffer, each at an offset aligned for
+// glBindBufferRange, written with a single glBufferSubData in frames where
+// any of them changed
+struct UniformBuffer {
+    unsigned int buffer = 0;
+    size_t offsets[UNIFORM_BLOCK_COUNT] = {};
+    size_t sizes[UNIFORM_BLOCK_COUNT] = { sizeof(FrameBlock), sizeof(LightsBlock), sizeof(MaterialBlock) };
+    std::vector<char> staging;
+    bool uploaded = false;
+    size_t issuedCalls = 0;
+    size_t avoidedCalls = 0;
+
+    void create() {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        size_t size = 0;
+        for (int block = 0; block < UNIFORM_BLOCK_COUNT; block++) {
+            offsets[block] = size;
+            size = (size + sizes[block] + alignment - 1) / alignment * alignment;
+        }
+        staging.assign(size, 0);
+
+        glGenBuffers(1, &buffer);
+        glState.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+        for (int block = 0; block < UNIFORM_BLOCK_COUNT; block++) {
+            glState.bindBufferRange(GL_UNIFORM_BUFFER, block, buffer, offsets[block], sizes[block]);
+        }
+    }
+
+    void destroy() {
+        glState.deleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+
+    void update(const FrameBlock& frame, const LightsBlock& lights, const MaterialBlock& material) {
+        const void* blocks[UNIFORM_BLOCK_COUNT] = { &frame, &lights, &material };
+        bool changed = !uploaded;
+        for (int block = 0; block < UNIFORM_BLOCK_COUNT; block++) {
+            char* staged = staging.data() + offsets[block];
+            if (memcmp(staged, blocks[block], sizes[block]) != 0) {
+                memcpy(staged, blocks[block], sizes[block]);
+                changed = true;
+            }
+        }
+        if (!changed) {
+            avoidedCalls++;
+            return;
+        }
+        glState.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, staging.size(), staging.data());
+        uploaded = true;
+        issuedCalls++;
+    }
+};
+
+// Attach the program's uniform blocks to their binding points
+void bindUniformBlocks(unsigned int program) {
+    for (int block = 0; block < UNIFORM_BLOCK_COUNT; block++) {
+        unsigned int index = glGetUniformBlockIndex(program, uniformBlockNames[block]);
+        if (index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(program, index, block);
+        }
+    }
+}
+
+// Function to compile shader
+unsigned int compileShader(const char* source, GLenum type) {
+    unsigned int shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    int success;
+    char infoLog[512];
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        glGetShaderInfoLog(shader, 512, NULL, infoLog);
+        std::cerr << "Shader compilation failed: " << infoLog << std::endl;
+    }
+    return shader;
+}
+
+// Function to create shader program; retrievable asks the driver to keep the
+// binary for glGetProgramBinary
+unsigned int createShaderProgram(const char* vertexSource, const char* fragmentSource, bool retrievable = false) {
+    unsigned int vertexShader = compileShader(vertexSource, GL_VERTEX_SHADER);
+    unsigned int fragmentShader = compileShader(fragmentSource, GL_FRAGMENT_SHADER);
+
+    unsigned int program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    if (retrievable) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(program);
+
+    int success;
+    char infoLog[512];
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        std::cerr << "Program linking failed: " << infoLog << std::endl;
+    }
+    bindUniformBlocks(program);
+
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    return program;
+}
+
+// Uniforms outside blocks that the renderer sets, resolved by name once per
+// program when it is reflected
+enum UniformHandle {
+    UNIFORM_POSITION_OFFSET,
+    UNIFORM_POSITION_SCALE,
+    UNIFORM_HANDLE_COUNT
+};
+
+const char* const uniformHandleNames[UNIFORM_HANDLE_COUNT] = {
+    "positionOffset",
+    "positionScale"
+};
+
+// A linked program with its active uniforms outside blocks reflected once.
+// The last value sent to each is shadowed, so setting an unchanged value
+// costs a compare instead of a GL call.
+struct ShaderProgram {
+    struct Uniform {
+        std::string name;
+        GLint location = -1;
+        GLenum type = 0;
+        unsigned char value[sizeof(glm::vec3)] = {};   // uniforms are zero after linking
+    };
+
+    unsigned int id = 0;
+    std::vector<Uniform> uniforms;
+    int handles[UNIFORM_HANDLE_COUNT];  // index into uniforms, -1 if inactive
+    size_t issuedCalls = 0;
+    size_t avoidedCalls = 0;
+
+    void reflect(unsigned int program) {
+        id = program;
+        uniforms.clear();
+        GLint count = 0;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        for (GLint i = 0; i < count; i++) {
+            GLuint index = i;
+            GLint blockIndex = -1;
+            glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_BLOCK_INDEX, &blockIndex);
+            if (blockIndex != -1) continue;
+
+            char name[256];
+            GLint size = 0;
+            Uniform uniform;
+            glGetActiveUniform(program, index, sizeof(name), NULL, &size, &uniform.type, name);
+            uniform.name = name;
+            uniform.location = glGetUniformLocation(program, name);
+            uniforms.push_back(uniform);
+        }
+
+        for (int handle = 0; handle < UNIFORM_HANDLE_COUNT; handle++) {
+            handles[handle] = -1;
+            for (size_t u = 0; u < uniforms.size(); u++) {
+                if (uniforms[u].name == uniformHandleNames[handle]) handles[handle] = (int)u;
+            }
+        }
+    }
+
+    void destroy() {
+        glState.deleteProgram(id);
+        id = 0;
+        uniforms.clear();
+    }
+
+    // The uniform to send the value to, or nullptr when it is inactive or
+    // already holds it
+    Uniform* changed(UniformHandle handle, const void* value, size_t size) {
+        if (handles[handle] < 0) return nullptr;
+        Uniform& uniform = uniforms[handles[handle]];
+        if (memcmp(uniform.value, value, size) == 0) {
+            avoidedCalls++;
+            return nullptr;
+        }
+        memcpy(uniform.value, value, size);
+        issuedCalls++;
+        return &uniform;
+    }
+
+    // Setter for the program in use
+    void setVec3(UniformHandle handle, const glm::vec3& value) {
+        if (Uniform* uniform = changed(handle, &value, sizeof(value))) {
+            glUniform3fv(uniform->location, 1, glm::value_ptr(value));
+        }
+    }
+};
+
+// Features a shading program is specialized for. Keys are literal types that
+// pack into a small integer, so the variant for a frame's state is looked up
+// by value and fixed variants can be named at compile time.
+enum ShadingModel {
+    SHADING_FLAT,
+    SHADING_GOURAUD,
+    SHADING_PHONG
+};
+
+enum ColorSource {
+    COLOR_NONE,
+    COLOR_VERTEX,   // interpolated vertex colors
+    COLOR_FACE      // face colors from the provoking vertex
+};
+
+struct ShaderKey {
+    ShadingModel shading;
+    int lightCount;
+    VertexFormat format;
+    ColorSource color;
+
+    // Flat shading is unlit, so its variants ignore the light count
+    constexpr ShaderKey(ShadingModel shading, int lightCount, VertexFormat format, ColorSource color)
+        : shading(shading), lightCount(shading == SHADING_FLAT ? 0 : lightCount), format(format), color(color) {}
+
+    constexpr uint32_t bits() const {
+        return (uint32_t)shading | (uint32_t)lightCount << 2 | (uint32_t)format << 5 | (uint32_t)color << 7;
+    }
+};
+
+static_assert(ShaderKey(SHADING_FLAT, 2, VERTEX_FLOAT, COLOR_NONE).bits() ==
+    ShaderKey(SHADING_FLAT, 0, VERTEX_FLOAT, COLOR_NONE).bits(), "flat variants are unlit");
+static_assert(MAX_LIGHTS < 8, "ShaderKey packs the light count into 3 bits");
+
+// GLSL for one stage of a variant: the version, the key's #defines, the
+// shared declarations, then the stage template
+std::string shaderVariantSource(const ShaderKey& key, const char* stageSource) {
+    std::string source = "#version 330 core\n";
+    source += "#define MAX_LIGHTS " + std::to_string(MAX_LIGHTS) + "\n";
+    source += "#define SHADING " + std::to_string(key.shading) + "\n";
+    source += "#define LIGHT_COUNT " + std::to_string(key.lightCount) + "\n";
+    source += "#define COMPACT_POSITIONS " + std::to_string(key.format != VERTEX_FLOAT) + "\n";
+    source += "#define OCTAHEDRAL_NORMALS " + std::to_string(key.format == VERTEX_OCTAHEDRAL) + "\n";
+    source += "#define COLOR_SOURCE " + std::to_string(key.color) + "\n";
+    source += shaderCommonSource;
+    source += stageSource;
+    return source;
+}
+
+// Vertex-only program whose outputs are captured with transform feedback,
+// interleaved in the order given
+unsigned int createTransformFeedbackProgram(const char* vertexSource, const std::vector<const char*>& varyings) {
+    unsigned int vertexShader = compileShader(vertexSource, GL_VERTEX_SHADER);
+
+    unsigned int program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glTransformFeedbackVaryings(program, (GLsizei)varyings.size(), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(program);
+
+    int success;
+    char infoLog[512];
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        std::cerr << "Program linking failed: " << infoLog << std::endl;
+    }
+
+    glDeleteShader(vertexShader);
+
+    return program;
+}
+
+// Programs of the GPU normal passes. The render pass captures the records of
+// the vertex format in use, so it is linked for that format.
+struct NormalPrograms {
+    unsigned int face = 0;
+    unsigned int vertex = 0;
+    unsigned int render = 0;
+
+    void create(VertexFormat format) {
+        face = createTransformFeedbackProgram(faceNormalShaderSource, { "faceNormal" });
+        vertex = createTransformFeedbackProgram(vertexNormalShaderSource, { "vertexNormal" });
+        if (format == VERTEX_FLOAT) {
+            render = createTransformFeedbackProgram(renderNormalShaderSource, { "words0to3", "word4", "words5to8", "word9" });
+        }
+        else {
+            render = createTransformFeedbackProgram(renderNormalShaderSource, { "words0to3", "word4" });
+        }
+    }
+
+    void destroy() {
+        glState.deleteProgram(face);
+        glState.deleteProgram(vertex);
+        glState.deleteProgram(render);
+    }
+};
+
+// Read-only memory mapping of a whole file
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = NULL;
+#else
+    int fd = -1;
+#endif
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& filename) {
+        close();
+#ifdef _WIN32
+        fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize)) {
+            close();
+            return false;
+        }
+        size = (size_t)fileSize.QuadPart;
+        if (size == 0) {
+            return true;
+        }
+        mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mappingHandle == NULL) {
+            close();
+            return false;
+        }
+        data = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+        fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close();
+            return false;
+        }
+        size = (size_t)st.st_size;
+        if (size == 0) {
+            return true;
+        }
+        void* addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close();
+            return false;
+        }
+        madvise(addr, size, MADV_SEQUENTIAL);
+        data = (const char*)addr;
+#endif
+        if (!data) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mappingHandle != NULL) CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+        mappingHandle = NULL;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap((void*)data, size);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+};
+
+// Skip spaces and tabs (and the '\r' of CRLF line endings)
+inline const char* skipBlanks(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+// Parse one number in place; on failure the value is 0, like operator>>
+inline const char* parseFloat(const char* p, const char* end, float& value) {
+    p = skipBlanks(p, end);
+    if (p < end && *p == '+') p++;
+    std::from_chars_result result = std::from_chars(p, end, value);
+    if (result.ec != std::errc()) {
+        value = 0.0f;
+        return p;
+    }
+    return result.ptr;
+}
+
+inline const char* parseIndex(const char* p, const char* end, unsigned int& value) {
+    p = skipBlanks(p, end);
+    if (p < end && *p == '+') p++;
+    std::from_chars_result result = std::from_chars(p, end, value);
+    if (result.ec != std::errc()) {
+        value = 0;
+        return p;
+    }
+    return result.ptr;
+}
+
+// Find the start of the next line
+inline const char* nextLine(const char* p, const char* end) {
+    const char* newline = (const char*)memchr(p, '\n', end - p);
+    return newline ? newline + 1 : end;
+}
+
+// Counting pass: number of 'v' and 'f' records in [begin, end)
+void countSMFRecords(const char* begin, const char* end, size_t& vertexCount, size_t& faceCount) {
+    vertexCount = 0;
+    faceCount = 0;
+    for (const char* p = begin; p < end; p = nextLine(p, end)) {
+        const char* q = p;
+        while (q < end && (*q == ' ' || *q == '\t' || *q == '\r')) q++;
+        if (q == end) break;
+        if (*q == 'v') vertexCount++;
+        else if (*q == 'f') faceCount++;
+    }
+}
+
+// How SMF 'n' and 'c' records map onto the mesh ('bind' record)
+enum AttributeBinding {
+    BIND_DEFAULT,    // no 'bind' record: decided by the record count
+    BIND_VERTEX,
+    BIND_FACE,
+    BIND_UNSUPPORTED
+};
+
+// Parse result of a text mesh file or of one line-aligned chunk of it. Face
+// corners whose index is relative to the chunk's first vertex (OBJ negative
+// indices) are listed in relativeCorners as face * 3 + corner.
+struct TextChunk {
+    std::vector<glm::vec3> positions;
+    std::vector<Triangle> triangles;
+    std::vector<size_t> relativeCorners;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec3> colors;
+    AttributeBinding normalBinding = BIND_DEFAULT;
+    AttributeBinding colorBinding = BIND_DEFAULT;
+};
+
+// Parse the arguments of a 'bind n|c vertex|face' record
+void parseBindRecord(const char* p, const char* end, TextChunk& chunk) {
+    p = skipBlanks(p, end);
+    if (p == end || (*p != 'n' && *p != 'c')) return;
+    AttributeBinding& target = *p == 'n' ? chunk.normalBinding : chunk.colorBinding;
+    p = skipBlanks(p + 1, end);
+    const char* word = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+    std::string mode(word, p);
+    target = mode == "vertex" ? BIND_VERTEX : mode == "face" ? BIND_FACE : BIND_UNSUPPORTED;
+}
+
+// Parse SMF records in [begin, end), appending to the chunk
+void parseSMFRecords(const char* begin, const char* end, TextChunk& chunk) {
+    for (const char* p = begin; p < end; p = nextLine(p, end)) {
+        const char* q = p;
+        while (q < end && (*q == ' ' || *q == '\t' || *q == '\r')) q++;
+        if (q == end) break;
+
+        char type = *q++;
+        if (type == 'v') {
+            float x, y, z;
+            q = parseFloat(q, end, x);
+            q = parseFloat(q, end, y);
+            q = parseFloat(q, end, z);
+            chunk.positions.push_back(glm::vec3(x, y, z));
+        }
+        else if (type == 'f') {
+            Triangle tri;
+            q = parseIndex(q, end, tri.indices[0]);
+            q = parseIndex(q, end, tri.indices[1]);
+            q = parseIndex(q, end, tri.indices[2]);
+            tri.indices[0]--; tri.indices[1]--; tri.indices[2]--;
+            tri.faceNormal = glm::vec3(0.0f);
+            chunk.triangles.push_back(tri);
+        }
+        else if (type == 'n' || type == 'c') {
+            float x, y, z;
+            q = parseFloat(q, end, x);
+            q = parseFloat(q, end, y);
+            q = parseFloat(q, end, z);
+            (type == 'n' ? chunk.normals : chunk.colors).push_back(glm::vec3(x, y, z));
+        }
+        else if (type == 'b' && end - q >= 3 && memcmp(q, "ind", 3) == 0) {
+            parseBindRecord(q + 3, end, chunk);
+        }
+    }
+}
+
+// Number of threads to use for a job of the given size
+unsigned int chooseThreadCount(size_t workSize, size_t minWorkPerThread) {
+    unsigned int threads = workerThreadCount;
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    size_t maxUseful = workSize / minWorkPerThread;
+    if (maxUseful < threads) {
+        threads = (unsigned int)std::max<size_t>(maxUseful, 1);
+    }
+    return threads;
+}
+
+// Run task(i) for every i in [0, count), one thread each
+template <typename Task>
+void runOnThreads(unsigned int count, Task task) {
+    std::vector<std::thread> workers;
+    workers.reserve(count);
+    for (unsigned int i = 1; i < count; i++) {
+        workers.emplace_back(task, i);
+    }
+    task(0u);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Parser for one line-aligned chunk of a text mesh file
+typedef void (*ChunkParser)(const char* begin, const char* end, TextChunk& chunk);
+
+void parseSMFChunk(const char* begin, const char* end, TextChunk& chunk) {
+    size_t vertexCount, faceCount;
+    countSMFRecords(begin, end, vertexCount, faceCount);
+    chunk.positions.reserve(vertexCount);
+    chunk.triangles.reserve(faceCount);
+    parseSMFRecords(begin, end, chunk);
+}
+
+// Concatenate per-chunk parse results in chunk order. A 'bind' record
+// applies to the whole file, so the last one seen wins.
+void stitchChunks(std::vector<TextChunk>& chunks, TextChunk& result) {
+    size_t chunkCount = chunks.size();
+    if (chunkCount == 1) {
+        std::swap(result, chunks[0]);
+        result.relativeCorners.clear();
+        return;
+    }
+
+    std::vector<size_t> vertexOffsets(chunkCount + 1, 0);
+    std::vector<size_t> faceOffsets(chunkCount + 1, 0);
+    std::vector<size_t> normalOffsets(chunkCount + 1, 0);
+    std::vector<size_t> colorOffsets(chunkCount + 1, 0);
+    for (size_t i = 0; i < chunkCount; i++) {
+        vertexOffsets[i + 1] = vertexOffsets[i] + chunks[i].positions.size();
+        faceOffsets[i + 1] = faceOffsets[i] + chunks[i].triangles.size();
+        normalOffsets[i + 1] = normalOffsets[i] + chunks[i].normals.size();
+        colorOffsets[i + 1] = colorOffsets[i] + chunks[i].colors.size();
+        if (chunks[i].normalBinding != BIND_DEFAULT) result.normalBinding = chunks[i].normalBinding;
+        if (chunks[i].colorBinding != BIND_DEFAULT) result.colorBinding = chunks[i].colorBinding;
+    }
+
+    result.positions.resize(vertexOffsets[chunkCount]);
+    result.triangles.resize(faceOffsets[chunkCount]);
+    result.normals.resize(normalOffsets[chunkCount]);
+    result.colors.resize(colorOffsets[chunkCount]);
+    unsigned int threads = chooseThreadCount(chunkCount, 1);
+    runOnThreads(threads, [&](unsigned int t) {
+        for (size_t i = t; i < chunkCount; i += threads) {
+            TextChunk& chunk = chunks[i];
+            std::copy(chunk.positions.begin(), chunk.positions.end(), result.positions.begin() + vertexOffsets[i]);
+            std::copy(chunk.triangles.begin(), chunk.triangles.end(), result.triangles.begin() + faceOffsets[i]);
+            std::copy(chunk.normals.begin(), chunk.normals.end(), result.normals.begin() + normalOffsets[i]);
+            std::copy(chunk.colors.begin(), chunk.colors.end(), result.colors.begin() + colorOffsets[i]);
+            for (size_t corner : chunk.relativeCorners) {
+                result.triangles[faceOffsets[i] + corner / 3].indices[corner % 3] += (unsigned int)vertexOffsets[i];
+            }
+            chunk = TextChunk();
+        }
+    });
+}
+
+// Resolve an attribute binding against the mesh size. Without a 'bind'
+// record the count decides; records that do not match are ignored.
+AttributeBinding resolveBinding(AttributeBinding binding, size_t recordCount, const MeshData& mesh, const char* name) {
+    if (recordCount == 0) {
+        return BIND_DEFAULT;
+    }
+    if (binding == BIND_DEFAULT) {
+        if (recordCount == mesh.positions.size()) return BIND_VERTEX;
+        if (recordCount == mesh.triangles.size()) return BIND_FACE;
+    }
+    else if (binding == BIND_VERTEX && recordCount == mesh.positions.size()) {
+        return BIND_VERTEX;
+    }
+    else if (binding == BIND_FACE && recordCount == mesh.triangles.size()) {
+        return BIND_FACE;
+    }
+    std::cerr << "Ignoring " << recordCount << " " << name << " records: binding "
+        << (binding == BIND_UNSUPPORTED ? "not supported" : "does not match the mesh") << std::endl;
+    return BIND_DEFAULT;
+}
+
+// Move a parsed text mesh into the mesh, attaching 'n' and 'c' records
+void finishTextMesh(TextChunk& parsed, MeshData& mesh) {
+    mesh.positions.swap(parsed.positions);
+    mesh.triangles.swap(parsed.triangles);
+
+    switch (resolveBinding(parsed.normalBinding, parsed.normals.size(), mesh, "normal")) {
+    case BIND_VERTEX:
+        mesh.normals.swap(parsed.normals);
+        break;
+    case BIND_FACE:
+        for (size_t i = 0; i < mesh.triangles.size(); i++) {
+            mesh.triangles[i].faceNormal = parsed.normals[i];
+        }
+        mesh.hasFaceNormals = true;
+        break;
+    default:
+        break;
+    }
+
+    switch (resolveBinding(parsed.colorBinding, parsed.colors.size(), mesh, "color")) {
+    case BIND_VERTEX:
+        mesh.colors.swap(parsed.colors);
+        break;
+    case BIND_FACE:
+        mesh.faceColors.swap(parsed.colors);
+        break;
+    default:
+        break;
+    }
+}
+
+// Parse a text mesh in [begin, end) on all cores. The range is split into
+// chunks at line boundaries, each chunk is parsed into its own buffers and the
+// buffers are concatenated in file order. SMF face indices refer to the global
+// vertex order, which the in-order stitch preserves, so they need no fix-up;
+// only corners reported as chunk-relative are shifted by the chunk's offset.
+void parseTextParallel(const char* begin, const char* end, TextChunk& result, ChunkParser parseChunk) {
+    const size_t minChunkBytes = 1 << 20;
+    unsigned int chunkCount = chooseThreadCount(end - begin, minChunkBytes);
+
+    std::vector<const char*> bounds(chunkCount + 1);
+    bounds[0] = begin;
+    bounds[chunkCount] = end;
+    for (unsigned int i = 1; i < chunkCount; i++) {
+        const char* split = begin + (end - begin) * i / chunkCount;
+        split = std::max(split, bounds[i - 1]);
+        bounds[i] = split > begin && split[-1] == '\n' ? split : nextLine(split, end);
+    }
+
+    std::vector<TextChunk> chunks(chunkCount);
+    runOnThreads(chunkCount, [&](unsigned int i) {
+        parseChunk(bounds[i], bounds[i + 1], chunks[i]);
+    });
+
+    stitchChunks(chunks, result);
+}
+
+// Print parse throughput for a load that started at startTime
+void reportParseRate(size_t bytes, std::chrono::steady_clock::time_point startTime) {
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    double megabytes = bytes / (1024.0 * 1024.0);
+    std::cout << "Parsed " << megabytes << " MB in " << seconds * 1000.0 << " ms ("
+        << (seconds > 0.0 ? megabytes / seconds : 0.0) << " MB/s)" << std::endl;
+}
+
+// Load SMF file with getline/istringstream
+bool loadSMFStream(const std::string& filename, MeshData& mesh) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        return false;
+    }
+
+    TextChunk parsed;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream iss(line);
+        std::string type;
+        iss >> type;
+
+        if (type == "v") {
+            float x, y, z;
+            iss >> x >> y >> z;
+            parsed.positions.push_back(glm::vec3(x, y, z));
+        }
+        else if (type == "f") {
+            Triangle tri;
+            iss >> tri.indices[0] >> tri.indices[1] >> tri.indices[2];
+            tri.indices[0]--; tri.indices[1]--; tri.indices[2]--;
+            tri.faceNormal = glm::vec3(0.0f);
+            parsed.triangles.push_back(tri);
+        }
+        else if (type == "n" || type == "c") {
+            float x = 0.0f, y = 0.0f, z = 0.0f;
+            iss >> x >> y >> z;
+            (type == "n" ? parsed.normals : parsed.colors).push_back(glm::vec3(x, y, z));
+        }
+        else if (type == "bind") {
+            std::string attribute, mode;
+            iss >> attribute >> mode;
+            AttributeBinding binding = mode == "vertex" ? BIND_VERTEX : mode == "face" ? BIND_FACE : BIND_UNSUPPORTED;
+            if (attribute == "n") parsed.normalBinding = binding;
+            else if (attribute == "c") parsed.colorBinding = binding;
+        }
+    }
+
+    file.close();
+    finishTextMesh(parsed, mesh);
+    return true;
+}
+
+// Load SMF file by memory-mapping it and tokenizing the mapped bytes
+bool loadSMFMapped(const std::string& filename, MeshData& mesh) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        return false;
+    }
+
+    const char* begin = file.data;
+    const char* end = file.data + file.size;
+
+    TextChunk parsed;
+    parseTextParallel(begin, end, parsed, parseSMFChunk);
+    finishTextMesh(parsed, mesh);
+
+    reportParseRate(file.size, startTime);
+    return true;
+}
+
+// Calculate model center and bounds
+void computeModelBounds(MeshData& mesh) {
+    mesh.center = glm::vec3(0.0f);
+    mesh.boundsMin = glm::vec3(mesh.positions.empty() ? 0.0f : INFINITY);
+    mesh.boundsMax = glm::vec3(mesh.positions.empty() ? 0.0f : -INFINITY);
+    for (const auto& pos : mesh.positions) {
+        mesh.center += pos;
+        mesh.boundsMin = glm::min(mesh.boundsMin, pos);
+        mesh.boundsMax = glm::max(mesh.boundsMax, pos);
+    }
+    if (!mesh.positions.empty()) {
+        mesh.center /= mesh.positions.size();
+    }
+}
+
+// Load SMF file
+bool loadSMF(const std::string& filename, MeshData& mesh) {
+    return useMappedLoader ? loadSMFMapped(filename, mesh) : loadSMFStream(filename, mesh);
+}
+
+// OBJ counting pass: 'v' records and an estimate of 'f' records
+void countOBJRecords(const char* begin, const char* end, size_t& vertexCount, size_t& faceCount) {
+    vertexCount = 0;
+    faceCount = 0;
+    for (const char* p = begin; p < end; p = nextLine(p, end)) {
+        const char* q = skipBlanks(p, end);
+        if (end - q < 2 || (q[1] != ' ' && q[1] != '\t')) continue;
+        if (q[0] == 'v') vertexCount++;
+        else if (q[0] == 'f') faceCount++;
+    }
+}
+
+// Parse the v/f subset of OBJ in [begin, end). Polygons are fan-triangulated;
+// texture and normal references (v/vt/vn) are skipped.
+void parseOBJChunk(const char* begin, const char* end, TextChunk& chunk) {
+    std::vector<glm::vec3>& positions = chunk.positions;
+    std::vector<Triangle>& tris = chunk.triangles;
+    std::vector<size_t>& relativeCorners = chunk.relativeCorners;
+    size_t vertexCount, faceCount;
+    countOBJRecords(begin, end, vertexCount, faceCount);
+    positions.reserve(vertexCount);
+    tris.reserve(faceCount);
+
+    std::vector<unsigned int> polygon;
+    std::vector<bool> polygonRelative;
+    for (const char* p = begin; p < end; p = nextLine(p, end)) {
+        const char* q = skipBlanks(p, end);
+        if (end - q < 2 || (q[1] != ' ' && q[1] != '\t')) continue;
+
+        if (q[0] == 'v') {
+            float x, y, z;
+            q = parseFloat(q + 1, end, x);
+            q = parseFloat(q, end, y);
+            q = parseFloat(q, end, z);
+            positions.push_back(glm::vec3(x, y, z));
+        }
+        else if (q[0] == 'f') {
+            polygon.clear();
+            polygonRelative.clear();
+            q++;
+            for (;;) {
+                q = skipBlanks(q, end);
+                int index;
+                std::from_chars_result result = std::from_chars(q, end, index);
+                if (result.ec != std::errc()) break;
+                q = result.ptr;
+                while (q < end && *q != ' ' && *q != '\t' && *q != '\r' && *q != '\n') q++;
+
+                // Negative indices count back from the last vertex read so far;
+                // indices start at 1, so 0 refers to no vertex
+                if (index < 0) {
+                    polygon.push_back((unsigned int)((long long)positions.size() + index));
+                    polygonRelative.push_back(true);
+                }
+                else if (index == 0) {
+                    polygon.push_back(INVALID_VERTEX);
+                    polygonRelative.push_back(false);
+                }
+                else {
+                    polygon.push_back((unsigned int)(index - 1));
+                    polygonRelative.push_back(false);
+                }
+            }
+
+            for (size_t i = 2; i < polygon.size(); i++) {
+                const size_t corners[3] = { 0, i - 1, i };
+                Triangle tri;
+                for (int c = 0; c < 3; c++) {
+                    tri.indices[c] = polygon[corners[c]];
+                    if (polygonRelative[corners[c]]) {
+                        relativeCorners.push_back(tris.size() * 3 + c);
+                    }
+                }
+                tri.faceNormal = glm::vec3(0.0f);
+                tris.push_back(tri);
+            }
+        }
+    }
+}
+
+// Load the v/f subset of an OBJ file through the mapped parallel parser
+bool loadOBJ(const std::string& filename, MeshData& mesh) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        return false;
+    }
+
+    TextChunk parsed;
+    parseTextParallel(file.data, file.data + file.size, parsed, parseOBJChunk);
+    finishTextMesh(parsed, mesh);
+
+    reportParseRate(file.size, startTime);
+    return true;
+}
+
+// PLY header description
+struct PlyProperty {
+    std::string name;
+    int type;         // scalar type, or the index type of a list
+    int countType;    // -1 for scalar properties
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+};
+
+// Size in bytes of a PLY scalar type name, 0 if unknown
+int plyTypeSize(const std::string& type) {
+    if (type == "char" || type == "uchar" || type == "int8" || type == "uint8") return 1;
+    if (type == "short" || type == "ushort" || type == "int16" || type == "uint16") return 2;
+    if (type == "int" || type == "uint" || type == "int32" || type == "uint32") return 4;
+    if (type == "float" || type == "float32") return 4;
+    if (type == "double" || type == "float64") return 8;
+    return 0;
+}
+
+// PLY scalar types, encoded as size * 4 + kind (0: signed, 1: unsigned, 2: float)
+int plyTypeCode(const std::string& type) {
+    int size = plyTypeSize(type);
+    if (size == 0) return -1;
+    if (type == "float" || type == "float32" || type == "double" || type == "float64") return size * 4 + 2;
+    if (type[0] == 'u') return size * 4 + 1;
+    return size * 4;
+}
+
+inline int plyCodeSize(int code) {
+    return code / 4;
+}
+
+// Read one little-endian PLY scalar
+inline double readPlyScalar(const char* p, int code) {
+    switch (code) {
+    case 1 * 4: { int8_t v; memcpy(&v, p, 1); return v; }
+    case 1 * 4 + 1: { uint8_t v; memcpy(&v, p, 1); return v; }
+    case 2 * 4: { int16_t v; memcpy(&v, p, 2); return v; }
+    case 2 * 4 + 1: { uint16_t v; memcpy(&v, p, 2); return v; }
+    case 4 * 4: { int32_t v; memcpy(&v, p, 4); return v; }
+    case 4 * 4 + 1: { uint32_t v; memcpy(&v, p, 4); return v; }
+    case 4 * 4 + 2: { float v; memcpy(&v, p, 4); return v; }
+    case 8 * 4 + 2: { double v; memcpy(&v, p, 8); return v; }
+    }
+    return 0.0;
+}
+
+// Read one little-endian PLY integer; float types read as -1
+inline int64_t readPlyInteger(const char* p, int code) {
+    switch (code) {
+    case 1 * 4: { int8_t v; memcpy(&v, p, 1); return v; }
+    case 1 * 4 + 1: { uint8_t v; memcpy(&v, p, 1); return v; }
+    case 2 * 4: { int16_t v; memcpy(&v, p, 2); return v; }
+    case 2 * 4 + 1: { uint16_t v; memcpy(&v, p, 2); return v; }
+    case 4 * 4: { int32_t v; memcpy(&v, p, 4); return v; }
+    case 4 * 4 + 1: { uint32_t v; memcpy(&v, p, 4); return v; }
+    }
+    return -1;
+}
+
+// Vertex index of a list entry; negative and non-integer ones are invalid
+inline unsigned int readPlyIndex(const char* p, int code) {
+    int64_t v = readPlyInteger(p, code);
+    return v < 0 || v > UINT32_MAX ? INVALID_VERTEX : (unsigned int)v;
+}
+
+// Parse the PLY header; data is set to the first byte of the body
+bool parsePlyHeader(const char* begin, const char* end, std::vector<PlyElement>& elements, const char*& data) {
+    std::string format;
+    for (const char* p = begin; p < end; ) {
+        const char* lineEnd = nextLine(p, end);
+        std::istringstream iss(std::string(p, lineEnd));
+        p = lineEnd;
+
+        std::string keyword;
+        iss >> keyword;
+        if (keyword == "format") {
+            iss >> format;
+        }
+        else if (keyword == "element") {
+            PlyElement element;
+            iss >> element.name >> element.count;
+            elements.push_back(element);
+        }
+        else if (keyword == "property" && !elements.empty()) {
+            PlyProperty property;
+            std::string type;
+            iss >> type;
+            if (type == "list") {
+                std::string countType, indexType;
+                iss >> countType >> indexType >> property.name;
+                property.countType = plyTypeCode(countType);
+                property.type = plyTypeCode(indexType);
+                if (property.countType < 0 || property.type < 0) return false;
+            }
+            else {
+                iss >> property.name;
+                property.countType = -1;
+                property.type = plyTypeCode(type);
+                if (property.type < 0) return false;
+            }
+            elements.back().properties.push_back(property);
+        }
+        else if (keyword == "end_header") {
+            if (format != "binary_little_endian") {
+                std::cerr << "Unsupported PLY format: " << format << " (only binary_little_endian)" << std::endl;
+                return false;
+            }
+            data = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Load a binary little-endian PLY file. Vertex records are copied straight
+// out of the mapped body; faces are fan-triangulated.
+bool loadPLY(const std::string& filename, MeshData& mesh) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        return false;
+    }
+
+    const char* end = file.data + file.size;
+    const char* p = nullptr;
+    std::vector<PlyElement> elements;
+    if (file.size < 4 || memcmp(file.data, "ply", 3) != 0 || !parsePlyHeader(file.data, end, elements, p)) {
+        std::cerr << "Invalid PLY header: " << filename << std::endl;
+        return false;
+    }
+
+    mesh.positions.clear();
+    mesh.triangles.clear();
+
+    bool truncated = false;
+    for (const PlyElement& element : elements) {
+        // Byte offsets of scalar properties; recordSize is -1 when the record has lists
+        std::vector<int> offsets;
+        int recordSize = 0;
+        for (const PlyProperty& property : element.properties) {
+            offsets.push_back(recordSize);
+            if (property.countType >= 0) {
+                recordSize = -1;
+                break;
+            }
+            recordSize += plyCodeSize(property.type);
+        }
+
+        if (recordSize >= 0 && (size_t)(end - p) / std::max(recordSize, 1) < element.count) {
+            truncated = true;
+            break;
+        }
+
+        if (element.name == "vertex") {
+            if (recordSize < 0) {
+                std::cerr << "PLY vertex element with list properties is not supported" << std::endl;
+                return false;
+            }
+
+            int axes[3] = { -1, -1, -1 };
+            for (size_t i = 0; i < element.properties.size(); i++) {
+                const std::string& name = element.properties[i].name;
+                if (name == "x" || name == "y" || name == "z") axes[name[0] - 'x'] = (int)i;
+            }
+            if (axes[0] < 0 || axes[1] < 0 || axes[2] < 0) {
+                std::cerr << "PLY vertex element lacks x/y/z" << std::endl;
+                return false;
+            }
+
+            mesh.positions.resize(element.count);
+            const int floatCode = 4 * 4 + 2;
+            bool packedFloats = element.properties[axes[0]].type == floatCode &&
+                element.properties[axes[1]].type == floatCode && element.properties[axes[2]].type == floatCode &&
+                offsets[axes[0]] == 0 && offsets[axes[1]] == 4 && offsets[axes[2]] == 8;
+            if (packedFloats && recordSize == sizeof(glm::vec3)) {
+                memcpy(mesh.positions.data(), p, element.count * sizeof(glm::vec3));
+            }
+            else if (packedFloats) {
+                for (size_t i = 0; i < element.count; i++) {
+                    memcpy(&mesh.positions[i], p + i * recordSize, sizeof(glm::vec3));
+                }
+            }
+            else {
+                for (size_t i = 0; i < element.count; i++) {
+                    const char* record = p + i * recordSize;
+                    for (int a = 0; a < 3; a++) {
+                        mesh.positions[i][a] = (float)readPlyScalar(record + offsets[axes[a]], element.properties[axes[a]].type);
+                    }
+                }
+            }
+            p += element.count * recordSize;
+        }
+        else if (recordSize >= 0) {
+            // Fixed-size element we do not use
+            p += element.count * recordSize;
+        }
+        else {
+            // Variable-size records (faces and anything else with lists)
+            bool isFace = element.name == "face";
+            if (isFace) {
+                mesh.triangles.reserve(element.count);
+            }
+            std::vector<unsigned int> polygon;
+            for (size_t f = 0; f < element.count && !truncated; f++) {
+                for (const PlyProperty& property : element.properties) {
+                    if (property.countType < 0) {
+                        if (end - p < plyCodeSize(property.type)) {
+                            truncated = true;
+                            break;
+                        }
+                        p += plyCodeSize(property.type);
+                        continue;
+                    }
+
+                    int countSize = plyCodeSize(property.countType);
+                    int indexSize = plyCodeSize(property.type);
+                    if (end - p < countSize) {
+                        truncated = true;
+                        break;
+                    }
+                    int64_t listCount = readPlyInteger(p, property.countType);
+                    if (listCount < 0) {
+                        std::cerr << "PLY list count is negative or not an integer: " << filename << std::endl;
+                        return false;
+                    }
+                    size_t count = (size_t)listCount;
+                    p += countSize;
+                    if ((size_t)(end - p) / indexSize < count) {
+                        truncated = true;
+                        break;
+                    }
+
+                    bool isIndexList = isFace && (property.name == "vertex_indices" || property.name == "vertex_index");
+                    if (isIndexList && count == 3 && indexSize == 4) {
+                        Triangle tri;
+                        memcpy(tri.indices, p, sizeof(tri.indices));
+                        tri.faceNormal = glm::vec3(0.0f);
+                        mesh.triangles.push_back(tri);
+                    }
+                    else if (isIndexList) {
+                        polygon.resize(count);
+                        for (size_t i = 0; i < count; i++) {
+                            polygon[i] = readPlyIndex(p + i * indexSize, property.type);
+                        }
+                        for (size_t i = 2; i < count; i++) {
+                            Triangle tri;
+                            tri.indices[0] = polygon[0];
+                            tri.indices[1] = polygon[i - 1];
+                            tri.indices[2] = polygon[i];
+                            tri.faceNormal = glm::vec3(0.0f);
+                            mesh.triangles.push_back(tri);
+                        }
+                    }
+                    p += count * indexSize;
+                }
+            }
+        }
+
+        if (truncated) {
+            break;
+        }
+    }
+
+    if (truncated) {
+        std::cerr << "PLY file is truncated: " << filename << std::endl;
+        return false;
+    }
+
+    reportParseRate(file.size, startTime);
+    return true;
+}
+
+// Weld vertices closer than epsilon, drop degenerate and duplicate faces and
+// unreferenced vertices. Vertices are bucketed in a spatial hash with cells of
+// size epsilon, so each vertex only looks at the representatives in its own
+// and the 26 neighbouring cells; the whole pass is linear in the mesh size.
+void weldMesh(MeshData& mesh, float epsilon) {
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<glm::vec3>& positions = mesh.positions;
+    std::vector<Triangle>& tris = mesh.triangles;
+    bool hasNormals = mesh.normals.size() == positions.size();
+    bool hasColors = mesh.colors.size() == positions.size();
+    bool hasFaceColors = mesh.faceColors.size() == tris.size();
+    size_t vertexCountBefore = positions.size();
+    size_t triangleCountBefore = tris.size();
+
+    // Representatives per cell as linked lists threaded through nextInCell
+    const unsigned int none = 0xffffffffu;
+    std::unordered_map<glm::i64vec3, unsigned int> cellHeads;
+    cellHeads.reserve(positions.size());
+    std::vector<unsigned int> nextInCell(positions.size(), none);
+    std::vector<unsigned int> remap(positions.size());
+    double inverseCell = epsilon > 0.0f ? 1.0 / epsilon : 0.0;
+
+    // Cell coordinates, plus the neighbour offsets, have to fit in int64
+    if (epsilon > 0.0f) {
+        double extent = 0.0;
+        for (const glm::vec3& p : positions) {
+            extent = std::max({ extent, std::fabs((double)p.x), std::fabs((double)p.y), std::fabs((double)p.z) });
+        }
+        if (!(extent * inverseCell < 4.0e18)) {
+            std::cerr << "Weld epsilon " << epsilon << " is too small for coordinates up to " << extent
+                << ", welding exact duplicates only" << std::endl;
+            epsilon = 0.0f;
+            inverseCell = 0.0;
+        }
+    }
+    float epsilon2 = epsilon * epsilon;
+
+    for (unsigned int i = 0; i < (unsigned int)positions.size(); i++) {
+        const glm::vec3& p = positions[i];
+        unsigned int match = none;
+        glm::i64vec3 cell;
+
+        if (epsilon > 0.0f) {
+            cell = glm::i64vec3(glm::floor(glm::dvec3(p) * inverseCell));
+            for (int dz = -1; dz <= 1 && match == none; dz++)
+            for (int dy = -1; dy <= 1 && match == none; dy++)
+            for (int dx = -1; dx <= 1 && match == none; dx++) {
+                auto head = cellHeads.find(cell + glm::i64vec3(dx, dy, dz));
+                if (head == cellHeads.end()) continue;
+                for (unsigned int r = head->second; r != none; r = nextInCell[r]) {
+                    glm::vec3 d = positions[r] - p;
+                    if (glm::dot(d, d) <= epsilon2) {
+                        match = r;
+                        break;
+                    }
+                }
+            }
+        }
+        else {
+            // Exact welding: the cell is the bit pattern (with -0 folded into 0)
+            glm::vec3 q = p + glm::vec3(0.0f);
+            uint32_t bits[3];
+            memcpy(bits, &q, sizeof(bits));
+            cell = glm::i64vec3(bits[0], bits[1], bits[2]);
+            auto head = cellHeads.find(cell);
+            if (head != cellHeads.end()) {
+                for (unsigned int r = head->second; r != none; r = nextInCell[r]) {
+                    if (positions[r] == p) {
+                        match = r;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (match != none) {
+            remap[i] = match;
+        }
+        else {
+            remap[i] = i;
+            auto inserted = cellHeads.emplace(cell, i);
+            if (!inserted.second) {
+                nextInCell[i] = inserted.first->second;
+                inserted.first->second = i;
+            }
+        }
+    }
+    std::unordered_map<glm::i64vec3, unsigned int>().swap(cellHeads);
+    std::vector<unsigned int>().swap(nextInCell);
+
+    // Faces: remap, then drop degenerate ones and repeats of the same face
+    // (same corners in the same cyclic order; the flipped face is kept)
+    std::unordered_set<glm::uvec3> seenFaces;
+    seenFaces.reserve(tris.size());
+    std::vector<bool> referenced(positions.size(), false);
+    size_t degenerateCount = 0, duplicateCount = 0;
+    size_t kept = 0;
+    for (size_t f = 0; f < tris.size(); f++) {
+        Triangle tri = tris[f];
+        for (int c = 0; c < 3; c++) {
+            tri.indices[c] = remap[tri.indices[c]];
+        }
+        unsigned int a = tri.indices[0], b = tri.indices[1], c = tri.indices[2];
+        if (a == b || b == c || a == c ||
+            glm::cross(positions[b] - positions[a], positions[c] - positions[a]) == glm::vec3(0.0f)) {
+            degenerateCount++;
+            continue;
+        }
+
+        glm::uvec3 key = a < b && a < c ? glm::uvec3(a, b, c) : (b < c ? glm::uvec3(b, c, a) : glm::uvec3(c, a, b));
+        if (!seenFaces.insert(key).second) {
+            duplicateCount++;
+            continue;
+        }
+
+        referenced[a] = referenced[b] = referenced[c] = true;
+        if (hasFaceColors) mesh.faceColors[kept] = mesh.faceColors[f];
+        tris[kept++] = tri;
+    }
+    tris.resize(kept);
+    if (hasFaceColors) {
+        mesh.faceColors.resize(kept);
+        mesh.faceColors.shrink_to_fit();
+    }
+    std::unordered_set<glm::uvec3>().swap(seenFaces);
+
+    // Vertices: keep referenced representatives in their original order
+    unsigned int newCount = 0;
+    for (size_t i = 0; i < positions.size(); i++) {
+        if (referenced[i]) {
+            positions[newCount] = positions[i];
+            if (hasNormals) mesh.normals[newCount] = mesh.normals[i];
+            if (hasColors) mesh.colors[newCount] = mesh.colors[i];
+            remap[i] = newCount++;
+        }
+    }
+    positions.resize(newCount);
+    positions.shrink_to_fit();
+    if (hasNormals) {
+        mesh.normals.resize(newCount);
+        mesh.normals.shrink_to_fit();
+    }
+    if (hasColors) {
+        mesh.colors.resize(newCount);
+        mesh.colors.shrink_to_fit();
+    }
+    tris.shrink_to_fit();
+    for (auto& tri : tris) {
+        for (int c = 0; c < 3; c++) {
+            tri.indices[c] = remap[tri.indices[c]];
+        }
+    }
+
+    // Saved memory: positions, vertex normals and the render vertex per
+    // vertex, the triangle record and its three render indices per face
+    size_t vertexBytes = 2 * sizeof(glm::vec3) + sizeof(Vertex);
+    size_t faceBytes = sizeof(Triangle) + 3 * sizeof(unsigned int);
+    size_t savedBytes = (vertexCountBefore - positions.size()) * vertexBytes +
+        (triangleCountBefore - tris.size()) * faceBytes;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Welded mesh in " << seconds * 1000.0 << " ms: vertices " << vertexCountBefore << " -> "
+        << positions.size() << ", triangles " << triangleCountBefore << " -> " << tris.size()
+        << " (" << degenerateCount << " degenerate, " << duplicateCount << " duplicate), saved "
+        << savedBytes / (1024.0 * 1024.0) << " MB" << std::endl;
+}
+
+// Sections of the binary mesh files start on 64-byte boundaries
+const uint64_t MESH_CACHE_ALIGNMENT = 64;
+
+inline uint64_t alignCacheOffset(uint64_t offset) {
+    return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(MESH_CACHE_ALIGNMENT - 1);
+}
+
+// Whether count elements of elementSize bytes fit in a file of fileSize bytes
+// at offset. Header values are untrusted, so the count is compared against the
+// space left after the offset instead of computing an end that could overflow.
+inline bool sectionFits(uint64_t fileSize, uint64_t offset, uint64_t count, uint64_t elementSize) {
+    return offset <= fileSize && count <= (fileSize - offset) / elementSize;
+}
+
+// Quantized mesh format (.smfq). Positions are 16-bit fixed point inside the
+// AABB, vertex normals are octahedral 2x16-bit snorm, and triangle indices are
+// delta + zigzag coded as LEB128 varints. The index stream restarts every
+// QUANTIZED_BLOCK_TRIANGLES triangles so blocks can be decoded in parallel.
+const uint32_t QUANTIZED_MESH_VERSION = 1;
+const uint32_t QUANTIZED_BLOCK_TRIANGLES = 1 << 16;
+
+struct QuantizedMeshHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t vertexCount;
+    uint64_t triangleCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t blockTriangles;
+    uint32_t blockCount;
+    uint64_t positionsOffset;
+    uint64_t normalsOffset;
+    uint64_t blockOffsetsOffset;
+    uint64_t indicesOffset;
+    uint64_t fileSize;
+};
+
+// Octahedral normal encoding, each component in [-1, 1]
+inline glm::vec2 octEncode(glm::vec3 n) {
+    float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (!(length > 0.0f)) {
+        return glm::vec2(0.0f);
+    }
+    n /= length;
+    glm::vec2 p(n.x, n.y);
+    if (n.z < 0.0f) {
+        p = (1.0f - glm::abs(glm::vec2(n.y, n.x))) *
+            glm::vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return p;
+}
+
+inline glm::vec3 octDecode(glm::vec2 p) {
+    glm::vec3 n(p.x, p.y, 1.0f - std::abs(p.x) - std::abs(p.y));
+    float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+inline void writeVarint(std::vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+// Write a mesh in the quantized format and report the size and error
+bool saveQuantizedMesh(const std::string& filename, const MeshData& mesh) {
+    QuantizedMeshHeader header = {};
+    memcpy(header.magic, "SMFQ", 4);
+    header.version = QUANTIZED_MESH_VERSION;
+    header.vertexCount = mesh.positions.size();
+    header.triangleCount = mesh.triangles.size();
+    header.blockTriangles = QUANTIZED_BLOCK_TRIANGLES;
+    header.blockCount = (uint32_t)((header.triangleCount + QUANTIZED_BLOCK_TRIANGLES - 1) / QUANTIZED_BLOCK_TRIANGLES);
+    for (int i = 0; i < 3; i++) {
+        header.boundsMin[i] = mesh.boundsMin[i];
+        header.boundsMax[i] = mesh.boundsMax[i];
+    }
+
+    glm::vec3 extent = mesh.boundsMax - mesh.boundsMin;
+    glm::vec3 scale = glm::vec3(65535.0f) / glm::max(extent, glm::vec3(1e-30f));
+    std::vector<uint16_t> positions(mesh.positions.size() * 3);
+    std::vector<int16_t> normals(mesh.positions.size() * 2, 0);
+    float maxPositionError = 0.0f, maxNormalError = 0.0f;
+    for (size_t i = 0; i < mesh.positions.size(); i++) {
+        glm::vec3 q = glm::clamp(glm::round((mesh.positions[i] - mesh.boundsMin) * scale), 0.0f, 65535.0f);
+        for (int a = 0; a < 3; a++) {
+            positions[i * 3 + a] = (uint16_t)q[a];
+        }
+        glm::vec3 decoded = mesh.boundsMin + q * (extent / 65535.0f);
+        maxPositionError = std::max(maxPositionError, glm::length(decoded - mesh.positions[i]));
+
+        if (i < mesh.normals.size()) {
+            glm::vec2 o = glm::round(glm::clamp(octEncode(mesh.normals[i]), -1.0f, 1.0f) * 32767.0f);
+            normals[i * 2] = (int16_t)o.x;
+            normals[i * 2 + 1] = (int16_t)o.y;
+            if (glm::length(mesh.normals[i]) > 0.5f) {
+                glm::vec3 n = octDecode(o / 32767.0f);
+                maxNormalError = std::max(maxNormalError, glm::length(n - mesh.normals[i]));
+            }
+        }
+    }
+
+    std::vector<uint8_t> indices;
+    indices.reserve(mesh.triangles.size() * 4);
+    std::vector<uint64_t> blockOffsets;
+    blockOffsets.reserve(header.blockCount + 1);
+    uint32_t previous = 0;
+    for (size_t t = 0; t < mesh.triangles.size(); t++) {
+        if (t % QUANTIZED_BLOCK_TRIANGLES == 0) {
+            blockOffsets.push_back(indices.size());
+            previous = 0;
+        }
+        for (int c = 0; c < 3; c++) {
+            int32_t delta = (int32_t)(mesh.triangles[t].indices[c] - previous);
+            writeVarint(indices, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+            previous = mesh.triangles[t].indices[c];
+        }
+    }
+    blockOffsets.push_back(indices.size());
+
+    header.positionsOffset = alignCacheOffset(sizeof(header));
+    header.normalsOffset = alignCacheOffset(header.positionsOffset + positions.size() * sizeof(uint16_t));
+    header.blockOffsetsOffset = alignCacheOffset(header.normalsOffset + normals.size() * sizeof(int16_t));
+    header.indicesOffset = alignCacheOffset(header.blockOffsetsOffset + blockOffsets.size() * sizeof(uint64_t));
+    header.fileSize = header.indicesOffset + indices.size();
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Failed to write quantized mesh: " << filename << std::endl;
+        return false;
+    }
+    const char zeros[MESH_CACHE_ALIGNMENT] = {};
+    auto writeSection = [&](uint64_t offset, const void* data, uint64_t bytes) {
+        file.write(zeros, offset - (uint64_t)file.tellp());
+        file.write((const char*)data, bytes);
+    };
+    file.write((const char*)&header, sizeof(header));
+    writeSection(header.positionsOffset, positions.data(), positions.size() * sizeof(uint16_t));
+    writeSection(header.normalsOffset, normals.data(), normals.size() * sizeof(int16_t));
+    writeSection(header.blockOffsetsOffset, blockOffsets.data(), blockOffsets.size() * sizeof(uint64_t));
+    writeSection(header.indicesOffset, indices.data(), indices.size());
+    if (!file) {
+        std::cerr << "Failed to write quantized mesh: " << filename << std::endl;
+        return false;
+    }
+
+    std::cout << "Wrote quantized mesh " << filename << ": " << header.fileSize / (1024.0 * 1024.0) << " MB ("
+        << (mesh.triangles.empty() ? 0.0 : (double)indices.size() / mesh.triangles.size()) << " index bytes per triangle), "
+        << "max position error " << maxPositionError << ", max normal error " << maxNormalError << std::endl;
+    return true;
+}
+
+// Load a quantized mesh, decoding vertices and index blocks on all cores
+bool loadQuantizedMesh(const std::string& filename, MeshData& mesh) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        return false;
+    }
+
+    QuantizedMeshHeader header;
+    if (file.size < sizeof(header)) {
+        std::cerr << "Invalid quantized mesh: " << filename << std::endl;
+        return false;
+    }
+    memcpy(&header, file.data, sizeof(header));
+
+    // Every triangle takes at least 3 bytes of index data
+    auto fits = [&](uint64_t offset, uint64_t count, uint64_t elementSize) {
+        return sectionFits(file.size, offset, count, elementSize);
+    };
+    uint64_t blockTriangles = std::max(header.blockTriangles, 1u);
+    uint64_t blockCount = header.triangleCount / blockTriangles + (header.triangleCount % blockTriangles != 0);
+    if (memcmp(header.magic, "SMFQ", 4) != 0 || header.version != QUANTIZED_MESH_VERSION ||
+        header.fileSize != file.size || header.blockTriangles == 0 || header.blockCount != blockCount ||
+        !fits(header.positionsOffset, header.vertexCount, 6) ||
+        !fits(header.normalsOffset, header.vertexCount, 4) ||
+        !fits(header.blockOffsetsOffset, blockCount + 1, 8) ||
+        !fits(header.indicesOffset, header.triangleCount, 3)) {
+        std::cerr << "Invalid quantized mesh: " << filename << std::endl;
+        return false;
+    }
+
+    glm::vec3 boundsMin = glm::make_vec3(header.boundsMin);
+    glm::vec3 step = (glm::make_vec3(header.boundsMax) - boundsMin) / 65535.0f;
+    const uint8_t* indexData = (const uint8_t*)file.data + header.indicesOffset;
+    uint64_t indexBytes = file.size - header.indicesOffset;
+    std::vector<uint64_t> blockOffsets(blockCount + 1);
+    memcpy(blockOffsets.data(), file.data + header.blockOffsetsOffset, blockOffsets.size() * sizeof(uint64_t));
+    for (size_t b = 0; b < blockCount; b++) {
+        if (blockOffsets[b] > blockOffsets[b + 1] || blockOffsets[b + 1] > indexBytes) {
+            std::cerr << "Invalid quantized mesh: " << filename << std::endl;
+            return false;
+        }
+    }
+
+    mesh.positions.resize(header.vertexCount);
+    mesh.normals.resize(header.vertexCount);
+    mesh.triangles.resize(header.triangleCount);
+
+    std::atomic<bool> corrupt{ false };
+    unsigned int threads = chooseThreadCount(header.vertexCount + header.triangleCount, 1 << 16);
+    runOnThreads(threads, [&](unsigned int t) {
+        size_t first = header.vertexCount * t / threads;
+        size_t last = header.vertexCount * (t + 1) / threads;
+        const char* positionData = file.data + header.positionsOffset;
+        const char* normalData = file.data + header.normalsOffset;
+        for (size_t i = first; i < last; i++) {
+            uint16_t q[3];
+            int16_t o[2];
+            memcpy(q, positionData + i * 6, 6);
+            memcpy(o, normalData + i * 4, 4);
+            mesh.positions[i] = boundsMin + glm::vec3(q[0], q[1], q[2]) * step;
+            mesh.normals[i] = octDecode(glm::max(glm::vec2(o[0], o[1]) / 32767.0f, -1.0f));
+        }
+
+        for (size_t b = t; b < blockCount; b += threads) {
+            const uint8_t* p = indexData + blockOffsets[b];
+            const uint8_t* end = indexData + blockOffsets[b + 1];
+            size_t firstTriangle = b * header.blockTriangles;
+            size_t lastTriangle = std::min<size_t>(firstTriangle + header.blockTriangles, header.triangleCount);
+            uint32_t previous = 0;
+            for (size_t f = firstTriangle; f < lastTriangle; f++) {
+                Triangle& tri = mesh.triangles[f];
+                for (int c = 0; c < 3; c++) {
+                    uint32_t value = 0;
+                    int shift = 0;
+                    while (p < end && (*p & 0x80) && shift < 28) {
+                        value |= (uint32_t)(*p++ & 0x7f) << shift;
+                        shift += 7;
+                    }
+                    if (p == end) {
+                        corrupt = true;
+                        return;
+                    }
+                    value |= (uint32_t)*p++ << shift;
+                    previous += (value >> 1) ^ (0u - (value & 1));
+                    tri.indices[c] = previous;
+                }
+                tri.faceNormal = glm::vec3(0.0f);
+            }
+        }
+    });
+
+    bool outOfRange = false;
+    for (const Triangle& tri : mesh.triangles) {
+        if (tri.indices[0] >= header.vertexCount || tri.indices[1] >= header.vertexCount || tri.indices[2] >= header.vertexCount) {
+            outOfRange = true;
+            break;
+        }
+    }
+    if (corrupt || outOfRange) {
+        std::cerr << "Invalid quantized mesh: " << filename << std::endl;
+        return false;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    double decodedMegabytes = (header.vertexCount * 2 * sizeof(glm::vec3) + header.triangleCount * sizeof(Triangle)) / (1024.0 * 1024.0);
+    std::cout << "Decoded " << file.size / (1024.0 * 1024.0) << " MB into " << decodedMegabytes << " MB in "
+        << seconds * 1000.0 << " ms (" << (seconds > 0.0 ? decodedMegabytes / seconds : 0.0) << " MB/s)" << std::endl;
+    return true;
+}
+
+// Mesh file formats understood by loadModel
+enum MeshFormat {
+    FORMAT_SMF,
+    FORMAT_OBJ,
+    FORMAT_PLY,
+    FORMAT_SMFQ
+};
+
+// Compressed text inputs (.gz / .zst around SMF or OBJ)
+enum Compression {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD
+};
+
+std::string lowercaseExtension(const std::string& filename) {
+    std::string extension = std::filesystem::path(filename).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)tolower(c); });
+    return extension;
+}
+
+// Pick a compression from the file extension, falling back to the magic bytes
+Compression detectCompression(const std::string& filename) {
+    std::string extension = lowercaseExtension(filename);
+    if (extension == ".gz") return COMPRESSION_GZIP;
+    if (extension == ".zst") return COMPRESSION_ZSTD;
+
+    unsigned char magic[4] = {};
+    std::ifstream file(filename, std::ios::binary);
+    file.read((char*)magic, 4);
+    if (magic[0] == 0x1f && magic[1] == 0x8b) return COMPRESSION_GZIP;
+    if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) return COMPRESSION_ZSTD;
+    return COMPRESSION_NONE;
+}
+
+// Pick a format from the file extension, falling back to the magic bytes
+MeshFormat detectMeshFormat(const std::string& filename) {
+    std::string extension = lowercaseExtension(filename);
+    if (extension == ".ply") return FORMAT_PLY;
+    if (extension == ".obj") return FORMAT_OBJ;
+    if (extension == ".smf") return FORMAT_SMF;
+    if (extension == ".smfq") return FORMAT_SMFQ;
+
+    char magic[4] = {};
+    std::ifstream file(filename, std::ios::binary);
+    file.read(magic, 4);
+    if (memcmp(magic, "ply", 3) == 0 && (magic[3] == '\n' || magic[3] == '\r')) return FORMAT_PLY;
+    if (memcmp(magic, "SMFQ", 4) == 0) return FORMAT_SMFQ;
+    return FORMAT_SMF;
+}
+
+// Incremental decompressor over a mapped compressed file
+struct StreamDecompressor {
+    Compression compression = COMPRESSION_NONE;
+    const char* input = nullptr;
+    size_t inputSize = 0;
+    size_t consumed = 0;
+    bool finished = false;
+    bool failed = false;
+#ifdef HAVE_ZLIB
+    z_stream zlibStream = {};
+    bool zlibActive = false;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream* zstdStream = nullptr;
+#endif
+
+    StreamDecompressor() = default;
+    StreamDecompressor(const StreamDecompressor&) = delete;
+    StreamDecompressor& operator=(const StreamDecompressor&) = delete;
+
+    ~StreamDecompressor() {
+#ifdef HAVE_ZLIB
+        if (zlibActive) inflateEnd(&zlibStream);
+#endif
+#ifdef HAVE_ZSTD
+        if (zstdStream) ZSTD_freeDStream(zstdStream);
+#endif
+    }
+
+    bool open(Compression type, const char* data, size_t size) {
+        compression = type;
+        input = data;
+        inputSize = size;
+        if (compression == COMPRESSION_GZIP) {
+#ifdef HAVE_ZLIB
+            // 15 + 32: maximum window, detect gzip or zlib headers
+            zlibActive = inflateInit2(&zlibStream, 15 + 32) == Z_OK;
+            return zlibActive;
+#else
+            std::cerr << "gzip input needs a build with HAVE_ZLIB" << std::endl;
+            return false;
+#endif
+        }
+        if (compression == COMPRESSION_ZSTD) {
+#ifdef HAVE_ZSTD
+            zstdStream = ZSTD_createDStream();
+            return zstdStream && !ZSTD_isError(ZSTD_initDStream(zstdStream));
+#else
+            std::cerr << "zstd input needs a build with HAVE_ZSTD" << std::endl;
+            return false;
+#endif
+        }
+        return false;
+    }
+
+    // Decompress up to capacity bytes into out; returns the number written
+    size_t read([[maybe_unused]] char* out, [[maybe_unused]] size_t capacity) {
+        size_t produced = 0;
+#ifdef HAVE_ZLIB
+        if (compression == COMPRESSION_GZIP) {
+            while (produced < capacity && !finished && !failed) {
+                size_t available = inputSize - consumed;
+                zlibStream.next_in = (Bytef*)(input + consumed);
+                zlibStream.avail_in = (uInt)std::min<size_t>(available, 1u << 30);
+                zlibStream.next_out = (Bytef*)(out + produced);
+                zlibStream.avail_out = (uInt)std::min<size_t>(capacity - produced, 1u << 30);
+                uInt inBefore = zlibStream.avail_in, outBefore = zlibStream.avail_out;
+                int status = inflate(&zlibStream, Z_NO_FLUSH);
+                consumed += inBefore - zlibStream.avail_in;
+                produced += outBefore - zlibStream.avail_out;
+
+                if (status == Z_STREAM_END) {
+                    // Concatenated gzip members continue the same text
+                    if (consumed < inputSize) inflateReset(&zlibStream);
+                    else finished = true;
+                }
+                else if (status != Z_OK && !(status == Z_BUF_ERROR && inBefore == zlibStream.avail_in && consumed < inputSize)) {
+                    failed = true;
+                }
+                else if (consumed == inputSize && outBefore == zlibStream.avail_out) {
+                    failed = true;  // truncated stream
+                }
+            }
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (compression == COMPRESSION_ZSTD) {
+            while (produced < capacity && !finished && !failed) {
+                ZSTD_inBuffer in = { input, inputSize, consumed };
+                ZSTD_outBuffer outBuffer = { out, capacity, produced };
+                size_t status = ZSTD_decompressStream(zstdStream, &outBuffer, &in);
+                bool progressed = in.pos != consumed || outBuffer.pos != produced;
+                consumed = in.pos;
+                produced = outBuffer.pos;
+                if (ZSTD_isError(status)) {
+                    failed = true;
+                }
+                else if (status == 0 && consumed == inputSize) {
+                    finished = true;
+                }
+                else if (!progressed) {
+                    failed = true;  // truncated stream
+                }
+            }
+        }
+#endif
+        return produced;
+    }
+};
+
+// Bounded ring buffer of line-aligned text blocks, one producer and any
+// number of consumers
+struct BlockQueue {
+    struct Block {
+        size_t sequence = 0;
+        std::vector<char> data;
+    };
+
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::vector<Block> ring;
+    size_t head = 0;
+    size_t count = 0;
+    bool closed = false;
+
+    explicit BlockQueue(size_t capacity) : ring(capacity) {}
+
+    void push(Block& block) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&] { return count < ring.size(); });
+        std::swap(ring[(head + count) % ring.size()], block);
+        count++;
+        notEmpty.notify_one();
+    }
+
+    // Blocks until a block is available; false once closed and drained
+    bool pop(Block& block) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&] { return count > 0 || closed; });
+        if (count == 0) {
+            return false;
+        }
+        std::swap(ring[head], block);
+        head = (head + 1) % ring.size();
+        count--;
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
+
+// Load a gzip/zstd compressed SMF or OBJ file without a temporary file. One
+// thread decompresses into line-aligned blocks and feeds a bounded queue;
+// the other threads parse blocks as they arrive and the per-block results
+// are stitched together in block order at the end.
+bool loadCompressedText(const std::string& filename, Compression compression, MeshFormat format, MeshData& mesh) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        return false;
+    }
+    StreamDecompressor decompressor;
+    if (!decompressor.open(compression, file.data, file.size)) {
+        std::cerr << "Failed to read compressed file: " << filename << std::endl;
+        return false;
+    }
+    ChunkParser parseChunk = format == FORMAT_OBJ ? parseOBJChunk : parseSMFChunk;
+
+    const size_t blockBytes = 4 << 20;
+    unsigned int parserCount = std::max(chooseThreadCount(SIZE_MAX, 1), 2u) - 1;
+    BlockQueue queue(2 * parserCount);
+
+    std::mutex resultMutex;
+    std::vector<TextChunk> chunks;
+    size_t decompressedBytes = 0;
+
+    runOnThreads(parserCount + 1, [&](unsigned int t) {
+        if (t == 0) {
+            // Decompressor: cut each block after its last newline and carry
+            // the partial line over to the next block
+            std::vector<char> carry;
+            size_t sequence = 0;
+            while (!decompressor.finished && !decompressor.failed) {
+                BlockQueue::Block block;
+                block.sequence = sequence;
+                block.data.resize(carry.size() + blockBytes);
+                memcpy(block.data.data(), carry.data(), carry.size());
+                size_t filled = carry.size() + decompressor.read(block.data.data() + carry.size(), blockBytes);
+                decompressedBytes += filled - carry.size();
+
+                size_t cut = filled;
+                if (!decompressor.finished) {
+                    while (cut > 0 && block.data[cut - 1] != '\n') cut--;
+                    if (cut == 0) {
+                        // A line longer than a block: keep accumulating
+                        carry.assign(block.data.begin(), block.data.begin() + filled);
+                        continue;
+                    }
+                }
+                carry.assign(block.data.begin() + cut, block.data.begin() + filled);
+                block.data.resize(cut);
+                queue.push(block);
+                sequence++;
+            }
+            queue.close();
+            return;
+        }
+
+        BlockQueue::Block block;
+        while (queue.pop(block)) {
+            TextChunk chunk;
+            parseChunk(block.data.data(), block.data.data() + block.data.size(), chunk);
+
+            std::lock_guard<std::mutex> lock(resultMutex);
+            if (chunks.size() <= block.sequence) {
+                chunks.resize(block.sequence + 1);
+            }
+            std::swap(chunks[block.sequence], chunk);
+        }
+    });
+
+    if (decompressor.failed) {
+        std::cerr << "Corrupt or truncated compressed file: " << filename << std::endl;
+        return false;
+    }
+
+    TextChunk parsed;
+    stitchChunks(chunks, parsed);
+    finishTextMesh(parsed, mesh);
+
+    std::cout << "Decompressed " << file.size / (1024.0 * 1024.0) << " MB to "
+        << decompressedBytes / (1024.0 * 1024.0) << " MB" << std::endl;
+    reportParseRate(decompressedBytes, startTime);
+    return true;
+}
+
+// Drop the faces from firstFace on whose indices point past the vertex list,
+// as malformed files produce, before anything indexes positions with them.
+// Face colors are kept in step with the faces.
+void dropInvalidFaces(MeshData& mesh, size_t firstFace = 0) {
+    std::vector<Triangle>& tris = mesh.triangles;
+    std::vector<glm::vec3>& faceColors = mesh.faceColors;
+    bool hasFaceColors = faceColors.size() == tris.size();
+    size_t vertexCount = mesh.positions.size();
+    size_t keptFaces = firstFace;
+    for (size_t i = firstFace; i < tris.size(); i++) {
+        const Triangle& tri = tris[i];
+        if (tri.indices[0] >= vertexCount || tri.indices[1] >= vertexCount || tri.indices[2] >= vertexCount) {
+            continue;
+        }
+        if (hasFaceColors) faceColors[keptFaces] = faceColors[i];
+        tris[keptFaces++] = tri;
+    }
+    if (keptFaces < tris.size()) {
+        std::cerr << "Dropped " << tris.size() - keptFaces << " faces with out-of-range vertex indices" << std::endl;
+        tris.resize(keptFaces);
+        if (hasFaceColors) faceColors.resize(keptFaces);
+    }
+}
+
+// Load a model in any supported format. Vertex normals, colors and face
+// normals are only filled in by formats that store them.
+bool loadModel(const std::string& filename, MeshData& mesh) {
+    bool loaded = false;
+    mesh.normals.clear();
+    mesh.colors.clear();
+    mesh.faceColors.clear();
+    mesh.hasFaceNormals = false;
+    Compression compression = detectCompression(filename);
+    if (compression != COMPRESSION_NONE) {
+        // The format comes from the name without the compression extension
+        std::string inner = std::filesystem::path(filename).replace_extension().string();
+        MeshFormat format = detectMeshFormat(inner);
+        if (format != FORMAT_SMF && format != FORMAT_OBJ) {
+            std::cerr << "Only SMF and OBJ can be read compressed: " << filename << std::endl;
+            return false;
+        }
+        loaded = loadCompressedText(filename, compression, format, mesh);
+    }
+    else switch (detectMeshFormat(filename)) {
+    case FORMAT_SMF: loaded = loadSMF(filename, mesh); break;
+    case FORMAT_OBJ: loaded = loadOBJ(filename, mesh); break;
+    case FORMAT_PLY: loaded = loadPLY(filename, mesh); break;
+    case FORMAT_SMFQ: loaded = loadQuantizedMesh(filename, mesh); break;
+    }
+    if (!loaded) {
+        return false;
+    }
+    dropInvalidFaces(mesh);
+
+    if (useWelding) {
+        weldMesh(mesh, weldEpsilon);
+    }
+
+    computeModelBounds(mesh);
+
+    std::cout << "Loaded " << mesh.positions.size() << " vertices and "
+        << mesh.triangles.size() << " triangles" << std::endl;
+
+    return true;
+}
+
+// Face normal of one triangle
+inline glm::vec3 faceNormalOf(const std::vector<glm::vec3>& positions, const Triangle& tri) {
+    glm::vec3 v0 = positions[tri.indices[0]];
+    glm::vec3 v1 = positions[tri.indices[1]];
+    glm::vec3 v2 = positions[tri.indices[2]];
+
+    glm::vec3 edge1 = v1 - v0;
+    glm::vec3 edge2 = v2 - v0;
+    return glm::normalize(glm::cross(edge1, edge2));
+}
+
+// SIMD support of the running CPU (x86 only; other targets use scalar code)
+SimdLevel detectSimdLevel() {
+#if defined(MESH_SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    bool avx2 = false;
+    if (osAvx && maxLeaf >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+    return avx2 ? SIMD_AVX2 : sse2 ? SIMD_SSE : SIMD_SCALAR;
+#elif defined(MESH_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2")) return SIMD_SSE;
+    return SIMD_SCALAR;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+SimdLevel activeSimdLevel() {
+    static const SimdLevel cpuLevel = detectSimdLevel();
+    return std::min(cpuLevel, maxSimdLevel);
+}
+
+// Face normals of tris[begin, end) one triangle at a time
+void faceNormalsScalar(const std::vector<glm::vec3>& positions, std::vector<Triangle>& tris, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        tris[i].faceNormal = faceNormalOf(positions, tris[i]);
+    }
+}
+
+#ifdef MESH_SIMD_X86
+#ifdef __GNUC__
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+// The SIMD kernels below work on SoA lanes: corner positions of 4 or 8
+// triangles are gathered into x/y/z registers, crossed and normalized with
+// the same operations as glm::normalize(glm::cross()), and scattered back to
+// the Triangle records. A degenerate triangle gives NaN, as in the scalar path.
+inline void scatterFaceNormals(Triangle* tris, const float* nx, const float* ny, const float* nz, int count) {
+    for (int lane = 0; lane < count; lane++) {
+        tris[lane].faceNormal = glm::vec3(nx[lane], ny[lane], nz[lane]);
+    }
+}
+
+SIMD_TARGET("sse2")
+void faceNormalsSSE(const std::vector<glm::vec3>& positions, std::vector<Triangle>& tris, size_t begin, size_t end) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    alignas(16) float nxOut[4], nyOut[4], nzOut[4];
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        const Triangle* t = &tris[i];
+        __m128 x[3], y[3], z[3];
+        for (int c = 0; c < 3; c++) {
+            const glm::vec3& p0 = positions[t[0].indices[c]];
+            const glm::vec3& p1 = positions[t[1].indices[c]];
+            const glm::vec3& p2 = positions[t[2].indices[c]];
+            const glm::vec3& p3 = positions[t[3].indices[c]];
+            x[c] = _mm_set_ps(p3.x, p2.x, p1.x, p0.x);
+            y[c] = _mm_set_ps(p3.y, p2.y, p1.y, p0.y);
+            z[c] = _mm_set_ps(p3.z, p2.z, p1.z, p0.z);
+        }
+        __m128 e1x = _mm_sub_ps(x[1], x[0]), e1y = _mm_sub_ps(y[1], y[0]), e1z = _mm_sub_ps(z[1], z[0]);
+        __m128 e2x = _mm_sub_ps(x[2], x[0]), e2y = _mm_sub_ps(y[2], y[0]), e2z = _mm_sub_ps(z[2], z[0]);
+
+        __m128 nx = _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y));
+        __m128 ny = _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z));
+        __m128 nz = _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x));
+        __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+        __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+
+        _mm_store_ps(nxOut, _mm_mul_ps(nx, inverseLength));
+        _mm_store_ps(nyOut, _mm_mul_ps(ny, inverseLength));
+        _mm_store_ps(nzOut, _mm_mul_ps(nz, inverseLength));
+        scatterFaceNormals(&tris[i], nxOut, nyOut, nzOut, 4);
+    }
+    faceNormalsScalar(positions, tris, i, end);
+}
+
+// The corners are loaded with scalar inserts rather than vgatherdps, which is
+// slower than plain loads on several AVX2 CPUs.
+SIMD_TARGET("avx2")
+void faceNormalsAVX2(const std::vector<glm::vec3>& positions, std::vector<Triangle>& tris, size_t begin, size_t end) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    alignas(32) float nxOut[8], nyOut[8], nzOut[8];
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        const Triangle* t = &tris[i];
+        __m256 x[3], y[3], z[3];
+        for (int c = 0; c < 3; c++) {
+            const glm::vec3* p[8];
+            for (int lane = 0; lane < 8; lane++) p[lane] = &positions[t[lane].indices[c]];
+            x[c] = _mm256_set_ps(p[7]->x, p[6]->x, p[5]->x, p[4]->x, p[3]->x, p[2]->x, p[1]->x, p[0]->x);
+            y[c] = _mm256_set_ps(p[7]->y, p[6]->y, p[5]->y, p[4]->y, p[3]->y, p[2]->y, p[1]->y, p[0]->y);
+            z[c] = _mm256_set_ps(p[7]->z, p[6]->z, p[5]->z, p[4]->z, p[3]->z, p[2]->z, p[1]->z, p[0]->z);
+        }
+        __m256 e1x = _mm256_sub_ps(x[1], x[0]), e1y = _mm256_sub_ps(y[1], y[0]), e1z = _mm256_sub_ps(z[1], z[0]);
+        __m256 e2x = _mm256_sub_ps(x[2], x[0]), e2y = _mm256_sub_ps(y[2], y[0]), e2z = _mm256_sub_ps(z[2], z[0]);
+
+        __m256 nx = _mm256_sub_ps(_mm256_mul_ps(e1y, e2z), _mm256_mul_ps(e1z, e2y));
+        __m256 ny = _mm256_sub_ps(_mm256_mul_ps(e1z, e2x), _mm256_mul_ps(e1x, e2z));
+        __m256 nz = _mm256_sub_ps(_mm256_mul_ps(e1x, e2y), _mm256_mul_ps(e1y, e2x));
+        __m256 lengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(ny, ny)), _mm256_mul_ps(nz, nz));
+        __m256 inverseLength = _mm256_div_ps(one, _mm256_sqrt_ps(lengthSquared));
+
+        _mm256_store_ps(nxOut, _mm256_mul_ps(nx, inverseLength));
+        _mm256_store_ps(nyOut, _mm256_mul_ps(ny, inverseLength));
+        _mm256_store_ps(nzOut, _mm256_mul_ps(nz, inverseLength));
+        scatterFaceNormals(&tris[i], nxOut, nyOut, nzOut, 8);
+    }
+    faceNormalsScalar(positions, tris, i, end);
+}
+#endif
+
+// Calculate face normals with the widest kernel the CPU supports, split
+// across the worker threads
+void calculateFaceNormals(const std::vector<glm::vec3>& positions, std::vector<Triangle>& tris) {
+    void (*kernel)(const std::vector<glm::vec3>&, std::vector<Triangle>&, size_t, size_t) = faceNormalsScalar;
+#ifdef MESH_SIMD_X86
+    switch (activeSimdLevel()) {
+    case SIMD_AVX2: kernel = faceNormalsAVX2; break;
+    case SIMD_SSE: kernel = faceNormalsSSE; break;
+    default: break;
+    }
+#endif
+
+    unsigned int threads = chooseThreadCount(tris.size(), 1 << 16);
+    runOnThreads(threads, [&](unsigned int t) {
+        kernel(positions, tris, tris.size() * t / threads, tris.size() * (t + 1) / threads);
+    });
+}
+
+void calculateFaceNormals() {
+    calculateFaceNormals(vertexPositions, triangles);
+}
+
+// Build the vertex-to-corner adjacency with a counting pass and a fill pass
+// in face order, which leaves every vertex's corners sorted by face
+void buildVertexAdjacency(size_t vertexCount, const std::vector<Triangle>& tris, VertexAdjacency& adjacency) {
+    adjacency.offsets.assign(vertexCount + 1, 0);
+    for (const auto& tri : tris) {
+        adjacency.offsets[tri.indices[0] + 1]++;
+        adjacency.offsets[tri.indices[1] + 1]++;
+        adjacency.offsets[tri.indices[2] + 1]++;
+    }
+    for (size_t v = 0; v < vertexCount; v++) {
+        adjacency.offsets[v + 1] += adjacency.offsets[v];
+    }
+
+    // Fill using offsets[v] as the write cursor of vertex v, then shift back
+    adjacency.corners.resize(tris.size() * 3);
+    for (size_t f = 0; f < tris.size(); f++) {
+        for (int c = 0; c < 3; c++) {
+            adjacency.corners[adjacency.offsets[tris[f].indices[c]]++] = (unsigned int)(f * 3 + c);
+        }
+    }
+    for (size_t v = vertexCount; v > 0; v--) {
+        adjacency.offsets[v] = adjacency.offsets[v - 1];
+    }
+    adjacency.offsets[0] = 0;
+}
+
+// Weight of a corner's face normal in its vertex normal: the face area or
+// the corner angle (1 for uniform weighting). Degenerate corners get 0.
+inline float cornerWeight(const std::vector<glm::vec3>& positions, const Triangle& tri, int corner, NormalWeighting weighting) {
+    if (weighting == WEIGHT_UNIFORM) {
+        return 1.0f;
+    }
+    glm::vec3 p = positions[tri.indices[corner]];
+    glm::vec3 a = positions[tri.indices[(corner + 1) % 3]] - p;
+    glm::vec3 b = positions[tri.indices[(corner + 2) % 3]] - p;
+    if (weighting == WEIGHT_AREA) {
+        return 0.5f * glm::length(glm::cross(a, b));
+    }
+    float lengths = glm::length(a) * glm::length(b);
+    return lengths > 0.0f ? std::acos(glm::clamp(glm::dot(a, b) / lengths, -1.0f, 1.0f)) : 0.0f;
+}
+
+// Normalized weighted sum of the face normals around vertex v, in face order.
+// weightOf(corner) gives the weight of a corner's face normal.
+template <typename CornerWeight>
+inline glm::vec3 gatherVertexNormal(size_t v, const std::vector<Triangle>& tris, const VertexAdjacency& adjacency,
+    CornerWeight weightOf) {
+    glm::vec3 sum(0.0f);
+    for (size_t k = adjacency.offsets[v]; k < adjacency.offsets[v + 1]; k++) {
+        unsigned int corner = adjacency.corners[k];
+        float weight = weightOf(corner);
+        if (weight > 0.0f) {
+            sum += weight * tris[corner / 3].faceNormal;
+        }
+    }
+    return glm::normalize(sum);
+}
+
+// Calculate vertex normals (weighted average of adjacent face normals). Each
+// vertex gathers its own corners through the adjacency, so vertices are
+// independent and split across threads; faces are summed in face order, which
+// makes the result bitwise identical for any thread count.
+void calculateVertexNormals(const std::vector<glm::vec3>& positions, const std::vector<Triangle>& tris,
+    const VertexAdjacency& adjacency, std::vector<glm::vec3>& normals) {
+    // Corner weights are computed once per corner in a parallel pass
+    std::vector<float> weights;
+    if (normalWeighting != WEIGHT_UNIFORM) {
+        weights.resize(tris.size() * 3);
+        unsigned int threads = chooseThreadCount(tris.size(), 1 << 16);
+        runOnThreads(threads, [&](unsigned int t) {
+            for (size_t f = tris.size() * t / threads; f < tris.size() * (t + 1) / threads; f++) {
+                for (int c = 0; c < 3; c++) {
+                    weights[f * 3 + c] = cornerWeight(positions, tris[f], c, normalWeighting);
+                }
+            }
+        });
+    }
+    auto weightOf = [&](unsigned int corner) { return weights.empty() ? 1.0f : weights[corner]; };
+
+    normals.resize(positions.size());
+    unsigned int threads = chooseThreadCount(positions.size(), 1 << 16);
+    runOnThreads(threads, [&](unsigned int t) {
+        for (size_t v = positions.size() * t / threads; v < positions.size() * (t + 1) / threads; v++) {
+            normals[v] = gatherVertexNormal(v, tris, adjacency, weightOf);
+        }
+    });
+}
+
+// Vertex normals of a mesh, building its adjacency first
+void calculateVertexNormals(MeshData& mesh) {
+    buildVertexAdjacency(mesh.positions.size(), mesh.triangles, mesh.adjacency);
+    calculateVertexNormals(mesh.positions, mesh.triangles, mesh.adjacency, mesh.normals);
+}
+
+// Adjacency of the current model (not stored in the mesh cache)
+void ensureVertexAdjacency() {
+    if (vertexAdjacency.offsets.size() != vertexPositions.size() + 1) {
+        buildVertexAdjacency(vertexPositions.size(), triangles, vertexAdjacency);
+    }
+}
+
+void calculateVertexNormals() {
+    ensureVertexAdjacency();
+    calculateVertexNormals(vertexPositions, triangles, vertexAdjacency, vertexNormals);
+}
+
+// CPU normals of the current model, which are left out when the GPU pass
+// wrote them straight into the vertex buffer
+void ensureVertexNormals() {
+    if (vertexNormals.size() != vertexPositions.size()) {
+        calculateFaceNormals();
+        calculateVertexNormals();
+    }
+}
+
+// Recompute the normals affected by moving the given vertices of the current
+// model: face normals of the faces around them, and vertex normals of every
+// vertex of those faces. Work and memory follow the size of the edit. The
+// vertices of those faces, whose render vertices change in every shading
+// mode (see renderVertex), are listed in changedVertices, sorted.
+void updateNormalsIncremental(const std::vector<unsigned int>& dirtyVertices, std::vector<unsigned int>& changedVertices) {
+    ensureVertexAdjacency();
+
+    std::vector<unsigned int> faces;
+    for (unsigned int v : dirtyVertices) {
+        for (size_t k = vertexAdjacency.offsets[v]; k < vertexAdjacency.offsets[v + 1]; k++) {
+            faces.push_back(vertexAdjacency.corners[k] / 3);
+        }
+    }
+    std::sort(faces.begin(), faces.end());
+    faces.erase(std::unique(faces.begin(), faces.end()), faces.end());
+
+    std::vector<unsigned int> affected;
+    affected.reserve(faces.size() * 3);
+    for (unsigned int f : faces) {
+        triangles[f].faceNormal = faceNormalOf(vertexPositions, triangles[f]);
+        affected.insert(affected.end(), triangles[f].indices, triangles[f].indices + 3);
+    }
+    std::sort(affected.begin(), affected.end());
+    affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+
+    auto weightOf = [&](unsigned int corner) {
+        return cornerWeight(vertexPositions, triangles[corner / 3], corner % 3, normalWeighting);
+    };
+    for (unsigned int v : affected) {
+        vertexNormals[v] = gatherVertexNormal(v, triangles, vertexAdjacency, weightOf);
+    }
+    changedVertices.swap(affected);
+}
+
+// Average cache miss ratio: vertices transformed per triangle when the faces
+// are drawn in order through a FIFO post-transform cache of cacheSize entries
+double averageCacheMissRatio(size_t vertexCount, const std::vector<Triangle>& tris, unsigned int cacheSize) {
+    if (tris.empty()) {
+        return 0.0;
+    }
+    // A vertex is cached while fewer than cacheSize misses followed its own
+    std::vector<size_t> missedAt(vertexCount, 0);
+    size_t time = cacheSize + 1;
+    size_t misses = 0;
+    for (const auto& tri : tris) {
+        for (int c = 0; c < 3; c++) {
+            unsigned int v = tri.indices[c];
+            if (time - missedAt[v] > cacheSize) {
+                missedAt[v] = time++;
+                misses++;
+            }
+        }
+    }
+    return (double)misses / tris.size();
+}
+
+// Reorder faces with Tipsify (Sander et al. 2007): emit every remaining face
+// around one vertex, then continue from the fan's vertex that will still be
+// cached after its own faces, backing up to recently used vertices at dead
+// ends. Vertices are then renumbered by first use so that vertex fetches walk
+// the buffer forwards. Linear in the mesh size.
+void optimizeMeshOrder(MeshData& mesh, unsigned int cacheSize) {
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<glm::vec3>& positions = mesh.positions;
+    std::vector<Triangle>& tris = mesh.triangles;
+    size_t vertexCount = positions.size();
+    double missRatioBefore = averageCacheMissRatio(vertexCount, tris, cacheSize);
+
+    VertexAdjacency adjacency;
+    buildVertexAdjacency(vertexCount, tris, adjacency);
+    std::vector<unsigned int> liveFaces(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        liveFaces[v] = (unsigned int)(adjacency.offsets[v + 1] - adjacency.offsets[v]);
+    }
+
+    const unsigned int none = 0xffffffffu;
+    std::vector<size_t> cachedAt(vertexCount, 0);
+    std::vector<bool> emitted(tris.size(), false);
+    std::vector<unsigned int> order, deadEnds, candidates;
+    order.reserve(tris.size());
+    size_t time = cacheSize + 1;
+    unsigned int cursor = 0;
+    unsigned int fan = vertexCount > 0 ? 0 : none;
+
+    while (fan != none) {
+        candidates.clear();
+        for (size_t k = adjacency.offsets[fan]; k < adjacency.offsets[fan + 1]; k++) {
+            unsigned int f = adjacency.corners[k] / 3;
+            if (emitted[f]) continue;
+            emitted[f] = true;
+            order.push_back(f);
+            for (int c = 0; c < 3; c++) {
+                unsigned int v = tris[f].indices[c];
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                liveFaces[v]--;
+                if (time - cachedAt[v] > cacheSize) {
+                    cachedAt[v] = time++;
+                }
+            }
+        }
+
+        // Prefer the oldest candidate that stays cached while its remaining
+        // faces (at most two new vertices each) are emitted
+        fan = none;
+        long long bestPriority = -1;
+        for (unsigned int v : candidates) {
+            if (liveFaces[v] == 0) continue;
+            long long priority = 0;
+            if (time - cachedAt[v] + 2 * liveFaces[v] <= cacheSize) {
+                priority = (long long)(time - cachedAt[v]);
+            }
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                fan = v;
+            }
+        }
+        while (fan == none && !deadEnds.empty()) {
+            unsigned int v = deadEnds.back();
+            deadEnds.pop_back();
+            if (liveFaces[v] > 0) fan = v;
+        }
+        while (fan == none && cursor < vertexCount) {
+            if (liveFaces[cursor] > 0) fan = cursor;
+            else cursor++;
+        }
+    }
+
+    std::vector<Triangle> reordered(tris.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        reordered[i] = tris[order[i]];
+    }
+    if (mesh.faceColors.size() == tris.size()) {
+        std::vector<glm::vec3> colors(tris.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            colors[i] = mesh.faceColors[order[i]];
+        }
+        mesh.faceColors.swap(colors);
+    }
+
+    // Vertices by first use; unreferenced ones keep their order at the end
+    std::vector<unsigned int> remap(vertexCount, none);
+    unsigned int nextVertex = 0;
+    for (auto& tri : reordered) {
+        for (int c = 0; c < 3; c++) {
+            unsigned int& index = tri.indices[c];
+            if (remap[index] == none) remap[index] = nextVertex++;
+            index = remap[index];
+        }
+    }
+    for (size_t v = 0; v < vertexCount; v++) {
+        if (remap[v] == none) remap[v] = nextVertex++;
+    }
+    auto permute = [&](std::vector<glm::vec3>& values) {
+        if (values.size() != vertexCount) return;
+        std::vector<glm::vec3> permuted(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++) {
+            permuted[remap[v]] = values[v];
+        }
+        values.swap(permuted);
+    };
+    permute(positions);
+    permute(mesh.normals);
+    permute(mesh.colors);
+    tris.swap(reordered);
+
+    double missRatioAfter = averageCacheMissRatio(vertexCount, tris, cacheSize);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Reordered mesh in " << seconds * 1000.0 << " ms: ACMR " << missRatioBefore << " -> "
+        << missRatioAfter << " (" << cacheSize << "-entry FIFO cache)" << std::endl;
+}
+
+// Compute only the normals the file did not provide. Vertex normals need
+// face normals, so face normals from the file are used for both.
+void calculateMissingNormals(MeshData& mesh) {
+    bool hasVertexNormals = mesh.normals.size() == mesh.positions.size();
+    if (!mesh.hasFaceNormals) {
+        calculateFaceNormals(mesh.positions, mesh.triangles);
+    }
+    if (!hasVertexNormals) {
+        calculateVertexNormals(mesh);
+    }
+    if (mesh.hasFaceNormals || hasVertexNormals) {
+        std::cout << "Using " << (mesh.hasFaceNormals ? "face " : "") << (mesh.hasFaceNormals && hasVertexNormals ? "and " : "")
+            << (hasVertexNormals ? "vertex " : "") << "normals from the file" << std::endl;
+    }
+}
+
+// Binary mesh cache layout. All sections start on a 64-byte boundary and hold
+// the in-memory representation, so a warm load is one copy per array.
+const uint32_t MESH_CACHE_VERSION = 2;
+
+// MeshCacheHeader::attributeFlags
+const uint32_t MESH_CACHE_VERTEX_COLORS = 1;
+const uint32_t MESH_CACHE_FACE_COLORS = 2;
+const uint32_t MESH_CACHE_NO_NORMALS = 4;   // normals left to the GPU pass; the section is empty
+
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint64_t sourceSize;
+    uint64_t vertexCount;
+    uint64_t triangleCount;
+    uint32_t triangleStride;
+    uint32_t attributeFlags;
+    float boundsMin[3];
+    float boundsMax[3];
+    float center[3];
+    float padding;
+    uint64_t positionsOffset;
+    uint64_t trianglesOffset;
+    uint64_t vertexNormalsOffset;
+    uint64_t colorsOffset;
+    uint64_t faceColorsOffset;
+    uint64_t fileSize;
+};
+
+static_assert(std::is_trivially_copyable<Triangle>::value, "Triangle is stored verbatim in the mesh cache");
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "glm::vec3 must be tightly packed");
+
+inline uint64_t mixHash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// 64-bit hash of a byte range, eight bytes per step
+uint64_t hashBytes(const char* data, size_t size, uint64_t seed) {
+    uint64_t h = seed ^ (size * 0x9e3779b97f4a7c15ULL);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ mixHash(word)) * 0x9e3779b97f4a7c15ULL;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, size - i);
+    return mixHash(h ^ mixHash(tail));
+}
+
+// Content hash of a file. Fixed-size blocks are hashed in parallel and then
+// combined in order, so the result does not depend on the thread count.
+bool hashFile(const std::string& filename, uint64_t& hash, uint64_t& size) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+
+    const size_t blockSize = 4 << 20;
+    size_t blockCount = (file.size + blockSize - 1) / blockSize;
+    std::vector<uint64_t> blockHashes(blockCount);
+    unsigned int threads = chooseThreadCount(blockCount, 1);
+    runOnThreads(threads, [&](unsigned int t) {
+        for (size_t b = t; b < blockCount; b += threads) {
+            size_t offset = b * blockSize;
+            blockHashes[b] = hashBytes(file.data + offset, std::min(blockSize, file.size - offset), b);
+        }
+    });
+
+    hash = hashBytes((const char*)blockHashes.data(), blockHashes.size() * sizeof(uint64_t), file.size);
+    size = file.size;
+    return true;
+}
+
+// Options that change the loaded arrays. They are mixed into the cache key,
+// so a cache written with different options is treated as stale.
+uint64_t meshProcessingKey() {
+    uint64_t key = 0;
+    if (useWelding) {
+        uint32_t bits;
+        memcpy(&bits, &weldEpsilon, sizeof(bits));
+        key ^= mixHash(0x1000000000ULL + bits);
+    }
+    if (useReordering) {
+        key ^= mixHash(0x3000000000ULL + vertexCacheSize);
+    }
+    if (normalWeighting != WEIGHT_UNIFORM) {
+        key ^= mixHash(0x2000000000ULL + normalWeighting);
+    }
+    return key;
+}
+
+// Cache file path for a source model
+std::string meshCachePath(const std::string& sourceFile) {
+    if (meshCacheDir.empty()) {
+        return sourceFile + ".smfb";
+    }
+    return (std::filesystem::path(meshCacheDir) / std::filesystem::path(sourceFile).filename()).string() + ".smfb";
+}
+
+// Load positions, triangles, normals and bounds from the binary cache
+bool loadMeshCache(const std::string& sourceFile, uint64_t sourceHash, uint64_t sourceSize, MeshData& mesh) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    MappedFile file;
+    if (!file.open(meshCachePath(sourceFile)) || file.size < sizeof(MeshCacheHeader)) {
+        return false;
+    }
+
+    MeshCacheHeader header;
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, "SMFB", 4) != 0 || header.version != MESH_CACHE_VERSION ||
+        header.sourceHash != sourceHash || header.sourceSize != sourceSize ||
+        header.triangleStride != sizeof(Triangle) || header.fileSize != file.size) {
+        std::cout << "Mesh cache is stale, re-parsing " << sourceFile << std::endl;
+        return false;
+    }
+
+    // The sizes are only multiplied out once the counts are known to fit
+    uint64_t colorCount = header.attributeFlags & MESH_CACHE_VERTEX_COLORS ? header.vertexCount : 0;
+    uint64_t faceColorCount = header.attributeFlags & MESH_CACHE_FACE_COLORS ? header.triangleCount : 0;
+    uint64_t normalCount = header.attributeFlags & MESH_CACHE_NO_NORMALS ? 0 : header.vertexCount;
+    if (!sectionFits(file.size, header.positionsOffset, header.vertexCount, sizeof(glm::vec3)) ||
+        !sectionFits(file.size, header.trianglesOffset, header.triangleCount, sizeof(Triangle)) ||
+        !sectionFits(file.size, header.vertexNormalsOffset, normalCount, sizeof(glm::vec3)) ||
+        !sectionFits(file.size, header.colorsOffset, colorCount, sizeof(glm::vec3)) ||
+        !sectionFits(file.size, header.faceColorsOffset, faceColorCount, sizeof(glm::vec3))) {
+        std::cerr << "Mesh cache is truncated: " << meshCachePath(sourceFile) << std::endl;
+        return false;
+    }
+    uint64_t positionsBytes = header.vertexCount * sizeof(glm::vec3);
+    uint64_t trianglesBytes = header.triangleCount * sizeof(Triangle);
+    uint64_t normalsBytes = normalCount * sizeof(glm::vec3);
+    uint64_t colorsBytes = colorCount * sizeof(glm::vec3);
+    uint64_t faceColorsBytes = faceColorCount * sizeof(glm::vec3);
+
+    mesh.positions.resize(header.vertexCount);
+    mesh.triangles.resize(header.triangleCount);
+    mesh.normals.resize(normalCount);
+    memcpy(mesh.positions.data(), file.data + header.positionsOffset, positionsBytes);
+    memcpy(mesh.triangles.data(), file.data + header.trianglesOffset, trianglesBytes);
+    for (const Triangle& tri : mesh.triangles) {
+        if (tri.indices[0] >= header.vertexCount || tri.indices[1] >= header.vertexCount || tri.indices[2] >= header.vertexCount) {
+            std::cerr << "Mesh cache is corrupt, re-parsing " << sourceFile << std::endl;
+            mesh = MeshData();
+            return false;
+        }
+    }
+    if (normalsBytes > 0) memcpy(mesh.normals.data(), file.data + header.vertexNormalsOffset, normalsBytes);
+    mesh.colors.resize(colorsBytes / sizeof(glm::vec3));
+    mesh.faceColors.resize(faceColorsBytes / sizeof(glm::vec3));
+    if (colorsBytes > 0) memcpy(mesh.colors.data(), file.data + header.colorsOffset, colorsBytes);
+    if (faceColorsBytes > 0) memcpy(mesh.faceColors.data(), file.data + header.faceColorsOffset, faceColorsBytes);
+    mesh.hasFaceNormals = normalCount > 0;
+
+    mesh.boundsMin = glm::make_vec3(header.boundsMin);
+    mesh.boundsMax = glm::make_vec3(header.boundsMax);
+    mesh.center = glm::make_vec3(header.center);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Loaded " << mesh.positions.size() << " vertices and " << mesh.triangles.size()
+        << " triangles from mesh cache in " << seconds * 1000.0 << " ms" << std::endl;
+    return true;
+}
+
+// Write the current mesh to the binary cache (via a temporary file and rename)
+bool saveMeshCache(const std::string& sourceFile, uint64_t sourceHash, uint64_t sourceSize, const MeshData& mesh) {
+    MeshCacheHeader header = {};
+    memcpy(header.magic, "SMFB", 4);
+    header.version = MESH_CACHE_VERSION;
+    header.sourceHash = sourceHash;
+    header.sourceSize = sourceSize;
+    header.vertexCount = mesh.positions.size();
+    header.triangleCount = mesh.triangles.size();
+    header.triangleStride = sizeof(Triangle);
+    header.attributeFlags = (mesh.colors.empty() ? 0 : MESH_CACHE_VERTEX_COLORS) |
+        (mesh.faceColors.empty() ? 0 : MESH_CACHE_FACE_COLORS) | (mesh.normalsPending ? MESH_CACHE_NO_NORMALS : 0);
+    for (int i = 0; i < 3; i++) {
+        header.boundsMin[i] = mesh.boundsMin[i];
+        header.boundsMax[i] = mesh.boundsMax[i];
+        header.center[i] = mesh.center[i];
+    }
+
+    uint64_t positionsBytes = header.vertexCount * sizeof(glm::vec3);
+    uint64_t trianglesBytes = header.triangleCount * sizeof(Triangle);
+    header.positionsOffset = alignCacheOffset(sizeof(MeshCacheHeader));
+    header.trianglesOffset = alignCacheOffset(header.positionsOffset + positionsBytes);
+    uint64_t normalsBytes = mesh.normalsPending ? 0 : positionsBytes;
+    uint64_t colorsBytes = mesh.colors.size() * sizeof(glm::vec3);
+    uint64_t faceColorsBytes = mesh.faceColors.size() * sizeof(glm::vec3);
+    header.vertexNormalsOffset = alignCacheOffset(header.trianglesOffset + trianglesBytes);
+    header.colorsOffset = alignCacheOffset(header.vertexNormalsOffset + normalsBytes);
+    header.faceColorsOffset = alignCacheOffset(header.colorsOffset + colorsBytes);
+    header.fileSize = header.faceColorsOffset + faceColorsBytes;
+
+    std::string path = meshCachePath(sourceFile);
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Failed to write mesh cache: " << tempPath << std::endl;
+            return false;
+        }
+
+        const char zeros[MESH_CACHE_ALIGNMENT] = {};
+        auto writeSection = [&](uint64_t offset, const void* data, uint64_t bytes) {
+            file.write(zeros, offset - (uint64_t)file.tellp());
+            file.write((const char*)data, bytes);
+        };
+        file.write((const char*)&header, sizeof(header));
+        writeSection(header.positionsOffset, mesh.positions.data(), positionsBytes);
+        writeSection(header.trianglesOffset, mesh.triangles.data(), trianglesBytes);
+        writeSection(header.vertexNormalsOffset, mesh.normals.data(), normalsBytes);
+        writeSection(header.colorsOffset, mesh.colors.data(), colorsBytes);
+        writeSection(header.faceColorsOffset, mesh.faceColors.data(), faceColorsBytes);
+        if (!file) {
+            std::cerr << "Failed to write mesh cache: " << tempPath << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    if (error) {
+        std::cerr << "Failed to write mesh cache: " << path << " (" << error.message() << ")" << std::endl;
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+    std::cout << "Wrote mesh cache: " << path << std::endl;
+    return true;
+}
+
+// Program binary cache (GL_ARB_get_program_binary). Each linked shader
+// variant is stored as <source hash>.glbin, with the driver's vendor,
+// renderer and version hashed into the header: binaries are only valid for
+// the driver that produced them, and one it rejects is compiled from source
+// again and overwritten.
+const uint32_t SHADER_CACHE_VERSION = 1;
+
+struct ShaderCacheHeader {
+    char magic[4];              // "GLPB"
+    uint32_t version;
+    uint64_t sourceHash;
+    uint64_t driverHash;
+    uint32_t binaryFormat;
+    uint32_t binarySize;
+};
+
+// Whether the driver can return program binaries at all
+bool shaderCacheSupported() {
+    if (!useShaderCache || !GLAD_GL_ARB_get_program_binary) {
+        return false;
+    }
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+uint64_t shaderDriverHash() {
+    std::string driver;
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+        const char* value = (const char*)glGetString(name);
+        driver += value ? value : "";
+        driver += '\n';
+    }
+    return hashBytes(driver.data(), driver.size(), SHADER_CACHE_VERSION);
+}
+
+// Cache file path for a program; next to the mesh caches with --cache-dir
+std::string shaderCachePath(uint64_t sourceHash) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.glbin", (unsigned long long)sourceHash);
+    std::filesystem::path directory = meshCacheDir.empty() ? std::filesystem::path("shader_cache") : std::filesystem::path(meshCacheDir);
+    return (directory / name).string();
+}
+
+// Program created from the cached binary, or 0 if there is no usable one
+unsigned int loadProgramBinary(uint64_t sourceHash, uint64_t driverHash) {
+    MappedFile file;
+    std::string path = shaderCachePath(sourceHash);
+    if (!file.open(path) || file.size < sizeof(ShaderCacheHeader)) {
+        return 0;
+    }
+
+    ShaderCacheHeader header;
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, "GLPB", 4) != 0 || header.version != SHADER_CACHE_VERSION ||
+        header.sourceHash != sourceHash || header.driverHash != driverHash ||
+        sizeof(header) + header.binarySize != file.size) {
+        std::cout << "Program binary cache is stale, compiling from source: " << path << std::endl;
+        return 0;
+    }
+
+    unsigned int program = glCreateProgram();
+    glProgramBinary(program, header.binaryFormat, file.data + sizeof(header), header.binarySize);
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        std::cout << "Driver rejected the cached program binary, compiling from source: " << path << std::endl;
+        glState.deleteProgram(program);
+        return 0;
+    }
+
+    // Block bindings are not necessarily part of the binary
+    bindUniformBlocks(program);
+    return program;
+}
+
+// Write a linked program to the cache (via a temporary file and rename)
+bool saveProgramBinary(unsigned int program, uint64_t sourceHash, uint64_t driverHash) {
+    int success, length = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (!success || length <= 0) {
+        return false;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    ShaderCacheHeader header = {};
+    memcpy(header.magic, "GLPB", 4);
+    header.version = SHADER_CACHE_VERSION;
+    header.sourceHash = sourceHash;
+    header.driverHash = driverHash;
+    header.binaryFormat = format;
+    header.binarySize = (uint32_t)length;
+
+    std::string path = shaderCachePath(sourceHash);
+    std::string tempPath = path + ".tmp";
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write((const char*)&header, sizeof(header));
+        file.write(binary.data(), length);
+        if (!file) {
+            std::cerr << "Failed to write program binary cache: " << tempPath << std::endl;
+            return false;
+        }
+    }
+
+    std::filesystem::rename(tempPath, path, error);
+    if (error) {
+        std::cerr << "Failed to write program binary cache: " << path << " (" << error.message() << ")" << std::endl;
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+    return true;
+}
+
+// Shading programs by key, compiled the first time a key is drawn with
+struct ShaderVariants {
+    std::unordered_map<uint32_t, ShaderProgram> programs;
+
+    ShaderProgram& get(const ShaderKey& key) {
+        auto found = programs.find(key.bits());
+        if (found != programs.end()) {
+            return found->second;
+        }
+
+        auto startTime = std::chrono::steady_clock::now();
+        std::string vertexSource = shaderVariantSource(key, shadingVertexShaderSource);
+        std::string fragmentSource = shaderVariantSource(key, shadingFragmentShaderSource);
+        uint64_t sourceHash = hashBytes(fragmentSource.data(), fragmentSource.size(),
+            hashBytes(vertexSource.data(), vertexSource.size(), SHADER_CACHE_VERSION));
+
+        // Prefer the cached binary; compile from source if there is none or
+        // the driver rejects it, and cache the result
+        bool cacheable = shaderCacheSupported();
+        uint64_t driverHash = cacheable ? shaderDriverHash() : 0;
+        unsigned int id = cacheable ? loadProgramBinary(sourceHash, driverHash) : 0;
+        bool fromCache = id != 0;
+        if (!fromCache) {
+            id = createShaderProgram(vertexSource.c_str(), fragmentSource.c_str(), cacheable);
+            if (cacheable) {
+                saveProgramBinary(id, sourceHash, driverHash);
+            }
+        }
+
+        ShaderProgram& program = programs[key.bits()];
+        program.reflect(id);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        std::cout << (fromCache ? "Loaded shader variant " : "Compiled shader variant ") << key.bits() << " ("
+                  << programs.size() << " total) " << (fromCache ? "from the program binary cache " : "")
+                  << "in " << seconds * 1000.0 << " ms" << std::endl;
+        return program;
+    }
+
+    void destroy() {
+        for (auto& entry : programs) {
+            entry.second.destroy();
+        }
+        programs.clear();
+    }
+};
+
+// Make a loaded mesh the current model
+void installMesh(MeshData& mesh) {
+    vertexPositions.swap(mesh.positions);
+    triangles.swap(mesh.triangles);
+    vertexNormals.swap(mesh.normals);
+    vertexColors.swap(mesh.colors);
+    faceColors.swap(mesh.faceColors);
+    std::swap(vertexAdjacency, mesh.adjacency);
+    renderLayout.valid = false;
+    normalsPending = mesh.normalsPending;
+    modelCenter = mesh.center;
+    modelBoundsMin = mesh.boundsMin;
+    modelBoundsMax = mesh.boundsMax;
+}
+
+// Load a model with normals, going through the mesh cache when enabled
+bool loadMeshFile(const std::string& filename, MeshData& mesh) {
+    uint64_t sourceHash = 0, sourceSize = 0;
+    bool cacheable = useMeshCache && hashFile(filename, sourceHash, sourceSize);
+    sourceHash ^= meshProcessingKey();
+    bool fromCache = cacheable && loadMeshCache(filename, sourceHash, sourceSize, mesh);
+    if (!fromCache) {
+        if (!loadModel(filename, mesh)) {
+            return false;
+        }
+        if (useReordering) {
+            optimizeMeshOrder(mesh, vertexCacheSize);
+        }
+    }
+
+    if (useGpuNormals && !mesh.hasFaceNormals && mesh.normals.size() != mesh.positions.size()) {
+        // Only the adjacency is built here; the GPU pass on the render thread
+        // writes the normals straight into the vertex buffer, so the cache
+        // stores the mesh without them
+        buildVertexAdjacency(mesh.positions.size(), mesh.triangles, mesh.adjacency);
+        mesh.normalsPending = true;
+    }
+    else if (!fromCache || mesh.normals.size() != mesh.positions.size()) {
+        calculateMissingNormals(mesh);
+    }
+    if (cacheable && !fromCache) {
+        saveMeshCache(filename, sourceHash, sourceSize, mesh);
+    }
+    return true;
+}
+
+// Assign every face a provoking slot, preferring the file's last corner and
+// then its other corners; a vertex is duplicated only when all three already
+// provoke other faces
+void buildRenderLayout(size_t vertexCount, const std::vector<Triangle>& tris, RenderLayout& layout) {
+    layout.provokedFace.assign(vertexCount, NO_FACE);
+    layout.nextDuplicate.assign(vertexCount, NO_FACE);
+    layout.duplicateSources.clear();
+    layout.provokingIndices.resize(tris.size() * 3);
+
+    for (size_t f = 0; f < tris.size(); f++) {
+        const unsigned int* corners = tris[f].indices;
+        int last = -1;
+        for (int c : { 2, 0, 1 }) {
+            if (layout.provokedFace[corners[c]] == NO_FACE) {
+                last = c;
+                break;
+            }
+        }
+
+        unsigned int slot;
+        if (last < 0) {
+            last = 2;
+            slot = (unsigned int)(vertexCount + layout.duplicateSources.size());
+            unsigned int next = layout.nextDuplicate[corners[2]];
+            layout.duplicateSources.push_back(corners[2]);
+            layout.provokedFace.push_back(NO_FACE);
+            layout.nextDuplicate.push_back(next);
+            layout.nextDuplicate[corners[2]] = slot;
+        }
+        else {
+            slot = corners[last];
+        }
+        layout.provokedFace[slot] = (unsigned int)f;
+
+        // Rotating keeps the winding
+        unsigned int* out = &layout.provokingIndices[f * 3];
+        out[0] = corners[(last + 1) % 3];
+        out[1] = corners[(last + 2) % 3];
+        out[2] = slot;
+    }
+    layout.valid = true;
+}
+
+// Colors from the file: vertex colors when there are any, else face colors.
+// The choice does not depend on the shading mode so that every mode can draw
+// the same vertices.
+bool renderUsesFaceColors() {
+    return !faceColors.empty() && vertexColors.empty();
+}
+
+// Render vertex of a layout slot. Face normals and face colors only go to
+// provoking slots; the other slots carry the vertex's own values. Normals
+// still pending for the GPU pass are left zero.
+Vertex renderVertex(unsigned int slot, bool useFaceColors) {
+    size_t vertexCount = vertexPositions.size();
+    unsigned int v = slot < vertexCount ? slot : renderLayout.duplicateSources[slot - vertexCount];
+    unsigned int face = renderLayout.provokedFace[slot];
+
+    Vertex out;
+    out.position = vertexPositions[v];
+    out.normal = normalsPending ? glm::vec3(0.0f) : vertexNormals[v];
+    out.faceNormal = face != NO_FACE && !normalsPending ? triangles[face].faceNormal : glm::vec3(0.0f);
+    if (useFaceColors) {
+        if (face != NO_FACE) out.color = glm::packUnorm4x8(glm::vec4(faceColors[face], 1.0f));
+    }
+    else if (!vertexColors.empty()) {
+        out.color = glm::packUnorm4x8(glm::vec4(vertexColors[v], 1.0f));
+    }
+    return out;
+}
+
+// Normal in the compact formats; zero and NaN normals are stored as zero
+uint32_t packNormal(glm::vec3 n) {
+    if (!(glm::dot(n, n) > 0.0f)) {
+        n = glm::vec3(0.0f);
+    }
+    if (vertexFormat == VERTEX_OCTAHEDRAL) {
+        return glm::packSnorm2x16(glm::clamp(octEncode(n), -1.0f, 1.0f));
+    }
+    return glm::packSnorm3x10_1x2(glm::vec4(n, 0.0f));
+}
+
+glm::vec3 unpackNormal(uint32_t packed) {
+    if (vertexFormat == VERTEX_OCTAHEDRAL) {
+        return octDecode(glm::unpackSnorm2x16(packed));
+    }
+    return glm::vec3(glm::unpackSnorm3x10_1x2(packed));
+}
+
+CompactVertex compactVertex(const Vertex& v) {
+    CompactVertex out;
+    out.position = glm::packUnorm<uint16_t>((v.position - quantizationMin) / quantizationScale);
+    out.normal = packNormal(v.normal);
+    out.faceNormal = packNormal(v.faceNormal);
+    out.color = v.color;
+    return out;
+}
+
+inline bool insideQuantizationBox(const glm::vec3& p) {
+    return glm::all(glm::greaterThanEqual(p, quantizationMin)) &&
+        glm::all(glm::lessThanEqual(p, quantizationMin + quantizationScale));
+}
+
+// Bytes of the render vertex buffer in the current format
+size_t renderVertexBytes() {
+    return vertexFormat == VERTEX_FLOAT ? vertices.size() * sizeof(Vertex) : compactVertices.size() * sizeof(CompactVertex);
+}
+
+// Largest position and normal error of the compact vertices against the
+// float data they were made from (normals only once they are on the CPU)
+void reportCompactError() {
+    float maxPositionError = 0.0f, maxNormalAngle = 0.0f;
+    for (size_t v = 0; v < vertexPositions.size(); v++) {
+        const CompactVertex& c = compactVertices[v];
+        glm::vec3 position = quantizationMin + quantizationScale * glm::unpackUnorm<float>(c.position);
+        maxPositionError = std::max(maxPositionError, glm::length(position - vertexPositions[v]));
+        glm::vec3 n = normalsPending ? glm::vec3(0.0f) : vertexNormals[v];
+        if (glm::dot(n, n) > 0.0f) {
+            float cosine = glm::clamp(glm::dot(glm::normalize(n), glm::normalize(unpackNormal(c.normal))), -1.0f, 1.0f);
+            maxNormalAngle = std::max(maxNormalAngle, glm::degrees(std::acos(cosine)));
+        }
+    }
+    float diagonal = glm::length(quantizationScale);
+    std::cout << "Compact vertices: " << sizeof(CompactVertex) << " instead of " << sizeof(Vertex) << " bytes ("
+              << compactVertices.size() * sizeof(CompactVertex) / (1024.0 * 1024.0) << " MB instead of "
+              << compactVertices.size() * sizeof(Vertex) / (1024.0 * 1024.0) << " MB), max position error "
+              << maxPositionError << " (" << maxPositionError / std::max(diagonal, 1e-30f) << " of the diagonal), max normal error "
+              << maxNormalAngle << " degrees" << std::endl;
+}
+
+// Prepare vertex data: one render vertex per layout slot and the indices of
+// both draw orders, so switching the shading mode only switches programs
+void prepareVertexData() {
+    if (!renderLayout.valid) {
+        buildRenderLayout(vertexPositions.size(), triangles, renderLayout);
+        size_t slotCount = renderLayout.provokedFace.size();
+        size_t vertexSize = vertexFormat == VERTEX_FLOAT ? sizeof(Vertex) : sizeof(CompactVertex);
+        size_t indexedBytes = slotCount * vertexSize + 2 * renderLayout.provokingIndices.size() * sizeof(unsigned int);
+        std::cout << "Indexed render buffers: " << slotCount << " vertices (" << renderLayout.duplicateSources.size()
+                  << " duplicated for flat attributes), 2 x " << renderLayout.provokingIndices.size() << " indices, "
+                  << indexedBytes / (1024.0 * 1024.0) << " MB for all shading modes" << std::endl;
+    }
+
+    bool useFaceColors = renderUsesFaceColors();
+    size_t slotCount = renderLayout.provokedFace.size();
+    if (vertexFormat == VERTEX_FLOAT) {
+        vertices.resize(slotCount);
+        for (size_t slot = 0; slot < slotCount; slot++) {
+            vertices[slot] = renderVertex((unsigned int)slot, useFaceColors);
+        }
+    }
+    else {
+        // The box is taken from the positions themselves, which sculpting
+        // may have moved past the model bounds
+        quantizationMin = glm::vec3(vertexPositions.empty() ? 0.0f : INFINITY);
+        glm::vec3 quantizationMax(vertexPositions.empty() ? 0.0f : -INFINITY);
+        for (const auto& p : vertexPositions) {
+            quantizationMin = glm::min(quantizationMin, p);
+            quantizationMax = glm::max(quantizationMax, p);
+        }
+        quantizationScale = glm::max(quantizationMax - quantizationMin, glm::vec3(1e-30f));
+
+        compactVertices.resize(slotCount);
+        for (size_t slot = 0; slot < slotCount; slot++) {
+            compactVertices[slot] = compactVertex(renderVertex((unsigned int)slot, useFaceColors));
+        }
+        reportCompactError();
+    }
+
+    // Without face colors the smooth modes use the model's own indices, which
+    // leave the duplicates unreferenced and keep the vertex cache order
+    flatIndices = renderLayout.provokingIndices;
+    if (useFaceColors) {
+        smoothIndices = flatIndices;
+    }
+    else {
+        smoothIndices.resize(triangles.size() * 3);
+        for (size_t f = 0; f < triangles.size(); f++) {
+            memcpy(&smoothIndices[f * 3], triangles[f].indices, sizeof(triangles[f].indices));
+        }
+    }
+}
+
+// Progressive load state shared by the loader thread and the render loop.
+// The loader owns the mesh until finished is set; everything
+// else is guarded by the mutex.
+struct StreamingLoad {
+    std::thread worker;
+    std::mutex mutex;
+    std::vector<Vertex> pendingVertices;
+    glm::vec3 positionSum = glm::vec3(0.0f);
+    size_t positionCount = 0;
+    bool failed = false;
+    std::atomic<bool> finished{ false };
+    std::atomic<bool> cancelled{ false };
+
+    MeshData mesh;
+};
+
+// Loader thread: parse the file slice by slice and publish every completed
+// face as three flat-shaded vertices, then finalize the normals
+void streamSMF(StreamingLoad* load, std::string filename) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    uint64_t sourceHash = 0, sourceSize = 0;
+    bool cacheable = useMeshCache && hashFile(filename, sourceHash, sourceSize);
+    sourceHash ^= meshProcessingKey();
+    if (cacheable && loadMeshCache(filename, sourceHash, sourceSize, load->mesh)) {
+        load->finished = true;
+        return;
+    }
+
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        std::lock_guard<std::mutex> lock(load->mutex);
+        load->failed = true;
+        load->finished = true;
+        return;
+    }
+
+    const size_t sliceBytes = 1 << 20;
+    const char* end = file.data + file.size;
+    size_t publishedFaces = 0;
+    std::vector<Vertex> batch;
+    TextChunk parsed;
+
+    for (const char* p = file.data; p < end && !load->cancelled; ) {
+        const char* sliceEnd = end - p > (ptrdiff_t)sliceBytes ? nextLine(p + sliceBytes, end) : end;
+        size_t firstNewPosition = parsed.positions.size();
+        parseSMFRecords(p, sliceEnd, parsed);
+        p = sliceEnd;
+
+        // Faces can only be shown once all of their vertices have been read
+        batch.clear();
+        unsigned int knownVertices = (unsigned int)parsed.positions.size();
+        while (publishedFaces < parsed.triangles.size()) {
+            Triangle& tri = parsed.triangles[publishedFaces];
+            if (tri.indices[0] >= knownVertices || tri.indices[1] >= knownVertices || tri.indices[2] >= knownVertices) {
+                break;
+            }
+            tri.faceNormal = faceNormalOf(parsed.positions, tri);
+            for (int i = 0; i < 3; i++) {
+                Vertex v;
+                v.position = parsed.positions[tri.indices[i]];
+                v.normal = tri.faceNormal;
+                v.faceNormal = tri.faceNormal;
+                batch.push_back(v);
+            }
+            publishedFaces++;
+        }
+
+        glm::vec3 sum(0.0f);
+        for (size_t i = firstNewPosition; i < parsed.positions.size(); i++) {
+            sum += parsed.positions[i];
+        }
+
+        std::lock_guard<std::mutex> lock(load->mutex);
+        load->pendingVertices.insert(load->pendingVertices.end(), batch.begin(), batch.end());
+        load->positionSum += sum;
+        load->positionCount = parsed.positions.size();
+    }
+
+    // A cancelled load is thrown away, so skip processing the partial parse
+    if (load->cancelled) {
+        load->finished = true;
+        return;
+    }
+
+    // Previewed faces already have their computed face normals
+    finishTextMesh(parsed, load->mesh);
+
+    // Faces that were never published may refer past the last vertex
+    dropInvalidFaces(load->mesh, publishedFaces);
+    if (useWelding) {
+        weldMesh(load->mesh, weldEpsilon);
+        publishedFaces = 0;
+    }
+    if (useReordering) {
+        optimizeMeshOrder(load->mesh, vertexCacheSize);
+        publishedFaces = 0;
+    }
+    if (!load->mesh.hasFaceNormals) {
+        for (size_t i = publishedFaces; i < load->mesh.triangles.size(); i++) {
+            load->mesh.triangles[i].faceNormal = faceNormalOf(load->mesh.positions, load->mesh.triangles[i]);
+        }
+    }
+    if (load->mesh.normals.size() != load->mesh.positions.size()) {
+        calculateVertexNormals(load->mesh);
+    }
+    computeModelBounds(load->mesh);
+    if (cacheable) {
+        saveMeshCache(filename, sourceHash, sourceSize, load->mesh);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Streamed " << load->mesh.positions.size() << " vertices and " << load->mesh.triangles.size()
+        << " triangles in " << seconds * 1000.0 << " ms" << std::endl;
+    load->finished = true;
+}
+
+// Background model load. The render loop only touches the mesh after
+// finished is set.
+struct AsyncLoad {
+    std::thread worker;
+    std::string filename;
+    MeshData mesh;
+    bool succeeded = false;
+    std::atomic<bool> finished{ false };
+};
+
+void loadMeshAsync(AsyncLoad* load) {
+    load->succeeded = loadMeshFile(load->filename, load->mesh);
+    load->finished = true;
+}
+
+std::unique_ptr<AsyncLoad> startAsyncLoad(const std::string& filename) {
+    std::cout << "Loading model in background: " << filename << std::endl;
+    std::unique_ptr<AsyncLoad> load(new AsyncLoad());
+    load->filename = filename;
+    load->worker = std::thread(loadMeshAsync, load.get());
+    return load;
+}
+
+// Watches one file for changes: inotify on Linux, change notifications on
+// Windows, modification time polling elsewhere. The containing directory is
+// watched so that editors which save by renaming a temporary file are seen.
+struct FileWatcher {
+    std::string path;
+    std::filesystem::file_time_type lastWriteTime;
+#if defined(__linux__)
+    int fd = -1;
+    std::string name;
+#elif defined(_WIN32)
+    HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+    std::chrono::steady_clock::time_point lastCheck;
+#endif
+
+    FileWatcher() = default;
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+    ~FileWatcher() { stop(); }
+
+    void watch(const std::string& filename) {
+        stop();
+        path = filename;
+        std::error_code error;
+        lastWriteTime = std::filesystem::last_write_time(path, error);
+        std::filesystem::path directory = std::filesystem::path(path).parent_path();
+        if (directory.empty()) {
+            directory = ".";
+        }
+#if defined(__linux__)
+        name = std::filesystem::path(path).filename().string();
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd >= 0 && inotify_add_watch(fd, directory.string().c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            ::close(fd);
+            fd = -1;
+        }
+#elif defined(_WIN32)
+        handle = FindFirstChangeNotificationA(directory.string().c_str(), FALSE,
+            FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+#else
+        lastCheck = std::chrono::steady_clock::now();
+#endif
+    }
+
+    void stop() {
+#if defined(__linux__)
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#elif defined(_WIN32)
+        if (handle != INVALID_HANDLE_VALUE) FindCloseChangeNotification(handle);
+        handle = INVALID_HANDLE_VALUE;
+#endif
+    }
+
+    // True once per change of the watched file; never blocks
+    bool poll() {
+        bool touched = false;
+#if defined(__linux__)
+        if (fd < 0) return false;
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+            for (char* p = buffer; p < buffer + length; ) {
+                const inotify_event* event = (const inotify_event*)p;
+                if (event->len > 0 && name == event->name) touched = true;
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+#elif defined(_WIN32)
+        if (handle == INVALID_HANDLE_VALUE || WaitForSingleObject(handle, 0) != WAIT_OBJECT_0) return false;
+        FindNextChangeNotification(handle);
+        touched = true;
+#else
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastCheck < std::chrono::milliseconds(500)) return false;
+        lastCheck = now;
+        touched = true;
+#endif
+        if (!touched) return false;
+
+        // Only report real content changes of this file
+        std::error_code error;
+        std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(path, error);
+        if (error || writeTime == lastWriteTime) return false;
+        lastWriteTime = writeTime;
+        return true;
+    }
+};
+
+// Point attributes 0/1/2 of the bound VAO at the Vertex layout of the bound VBO
+void configureVertexAttributes(VertexFormat format) {
+    if (format != VERTEX_FLOAT) {
+        GLsizei stride = sizeof(CompactVertex);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(CompactVertex, position));
+        glEnableVertexAttribArray(0);
+        if (format == VERTEX_OCTAHEDRAL) {
+            glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(CompactVertex, normal));
+            glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(CompactVertex, faceNormal));
+        }
+        else {
+            glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offsetof(CompactVertex, normal));
+            glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offsetof(CompactVertex, faceNormal));
+        }
+        glEnableVertexAttribArray(1);
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)offsetof(CompactVertex, color));
+        glEnableVertexAttribArray(2);
+        return;
+    }
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)offsetof(Vertex, color));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, faceNormal));
+    glEnableVertexAttribArray(3);
+}
+
+// GL objects of the model: one vertex buffer shared by a VAO per draw order,
+// and what is needed to draw them, which may lag behind the current model
+// while new buffers are uploaded in the background
+struct RenderBuffers {
+    unsigned int smoothVAO = 0;
+    unsigned int flatVAO = 0;
+    unsigned int VBO = 0;
+    unsigned int smoothEBO = 0;
+    unsigned int flatEBO = 0;
+
+    size_t smoothCount = 0;
+    size_t flatCount = 0;
+    VertexFormat format = VERTEX_FLOAT;
+    glm::vec3 positionOffset = glm::vec3(0.0f);
+    glm::vec3 positionScale = glm::vec3(1.0f);
+    bool useVertexColor = false;
+    bool useFaceColor = false;
+};
+
+// Record how the current render data is drawn
+void describeRenderBuffers(RenderBuffers& buffers) {
+    buffers.smoothCount = smoothIndices.size();
+    buffers.flatCount = flatIndices.size();
+    buffers.format = vertexFormat;
+    buffers.positionOffset = vertexFormat == VERTEX_FLOAT ? glm::vec3(0.0f) : quantizationMin;
+    buffers.positionScale = vertexFormat == VERTEX_FLOAT ? glm::vec3(1.0f) : quantizationScale;
+    buffers.useVertexColor = !vertexColors.empty() || !faceColors.empty();
+    buffers.useFaceColor = renderUsesFaceColors();
+}
+
+// Point both VAOs at the buffers
+void configureVertexArrays(const RenderBuffers& buffers) {
+    glState.bindBuffer(GL_ARRAY_BUFFER, buffers.VBO);
+    glState.bindVertexArray(buffers.smoothVAO);
+    glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.smoothEBO);
+    configureVertexAttributes(buffers.format);
+    glState.bindVertexArray(buffers.flatVAO);
+    glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.flatEBO);
+    configureVertexAttributes(buffers.format);
+    glState.bindVertexArray(0);
+}
+
+void createRenderBuffers(RenderBuffers& buffers) {
+    glGenVertexArrays(1, &buffers.smoothVAO);
+    glGenVertexArrays(1, &buffers.flatVAO);
+    glGenBuffers(1, &buffers.VBO);
+    glGenBuffers(1, &buffers.smoothEBO);
+    glGenBuffers(1, &buffers.flatEBO);
+}
+
+void deleteRenderBuffers(RenderBuffers& buffers) {
+    glState.deleteVertexArrays(1, &buffers.smoothVAO);
+    glState.deleteVertexArrays(1, &buffers.flatVAO);
+    glState.deleteBuffers(1, &buffers.VBO);
+    glState.deleteBuffers(1, &buffers.smoothEBO);
+    glState.deleteBuffers(1, &buffers.flatEBO);
+    buffers = RenderBuffers();
+}
+
+// Upload the render vertices and both index orders on the render thread
+void uploadRenderBuffers(RenderBuffers& buffers) {
+    glState.bindBuffer(GL_COPY_WRITE_BUFFER, buffers.VBO);
+    if (vertexFormat == VERTEX_FLOAT) {
+        glBufferData(GL_COPY_WRITE_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+    }
+    else {
+        glBufferData(GL_COPY_WRITE_BUFFER, compactVertices.size() * sizeof(CompactVertex), compactVertices.data(), GL_STATIC_DRAW);
+    }
+    glState.bindBuffer(GL_COPY_WRITE_BUFFER, buffers.smoothEBO);
+    glBufferData(GL_COPY_WRITE_BUFFER, smoothIndices.size() * sizeof(unsigned int), smoothIndices.data(), GL_STATIC_DRAW);
+    glState.bindBuffer(GL_COPY_WRITE_BUFFER, buffers.flatEBO);
+    glBufferData(GL_COPY_WRITE_BUFFER, flatIndices.size() * sizeof(unsigned int), flatIndices.data(), GL_STATIC_DRAW);
+
+    describeRenderBuffers(buffers);
+    configureVertexArrays(buffers);
+}
+
+// Background upload of the render buffers. The uploader thread owns a hidden
+// window whose context shares objects with the main one: it creates the
+// buffers, fills them in chunks and fences the result. VAOs are not shared
+// between contexts, so the render thread creates them once the fence has
+// signaled and swaps the buffers in.
+const size_t UPLOAD_CHUNK_BYTES = 16 << 20;
+
+struct UploadJob {
+    // The render data, moved out of the globals while it is uploaded
+    std::vector<Vertex> vertices;
+    std::vector<CompactVertex> compactVertices;
+    std::vector<unsigned int> smoothIndices;
+    std::vector<unsigned int> flatIndices;
+
+    RenderBuffers buffers;
+    GLsync fence = nullptr;
+    std::chrono::steady_clock::time_point submitted;
+};
+
+// Fill a buffer in chunks of UPLOAD_CHUNK_BYTES; runs on the uploader's
+// context, so it binds directly rather than through glState
+void uploadInChunks(unsigned int buffer, const void* data, size_t bytes) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+    for (size_t offset = 0; offset < bytes; offset += UPLOAD_CHUNK_BYTES) {
+        glBufferSubData(GL_COPY_WRITE_BUFFER, offset, std::min(UPLOAD_CHUNK_BYTES, bytes - offset), (const char*)data + offset);
+    }
+}
+
+struct BufferUploader {
+    GLFWwindow* context = nullptr;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::unique_ptr<UploadJob> queued;      // waiting for the uploader thread
+    std::unique_ptr<UploadJob> uploaded;    // fenced, waiting for the render thread
+    bool busy = false;                      // a job is between submit and take
+    bool stopping = false;
+
+    // Create the shared context; must run on the main thread
+    bool start(GLFWwindow* mainWindow) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        context = glfwCreateWindow(1, 1, "Uploader", NULL, mainWindow);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        if (!context) {
+            return false;
+        }
+        worker = std::thread(&BufferUploader::run, this);
+        return true;
+    }
+
+    void stop() {
+        if (!context) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+        if (uploaded) {
+            glDeleteSync(uploaded->fence);
+            glState.deleteBuffers(1, &uploaded->buffers.VBO);
+            glState.deleteBuffers(1, &uploaded->buffers.smoothEBO);
+            glState.deleteBuffers(1, &uploaded->buffers.flatEBO);
+            uploaded.reset();
+        }
+        glfwDestroyWindow(context);
+        context = nullptr;
+    }
+
+    // Hand the current render data to the uploader thread
+    void submit() {
+        std::unique_ptr<UploadJob> job(new UploadJob());
+        describeRenderBuffers(job->buffers);
+        job->vertices.swap(vertices);
+        job->compactVertices.swap(compactVertices);
+        job->smoothIndices.swap(smoothIndices);
+        job->flatIndices.swap(flatIndices);
+        job->submitted = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued = std::move(job);
+            busy = true;
+        }
+        wake.notify_one();
+    }
+
+    // The finished job once its fence has signaled, without waiting
+    std::unique_ptr<UploadJob> take() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!uploaded || glClientWaitSync(uploaded->fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            return nullptr;
+        }
+        glDeleteSync(uploaded->fence);
+        uploaded->fence = nullptr;
+        busy = false;
+        return std::move(uploaded);
+    }
+
+    void run() {
+        glfwMakeContextCurrent(context);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [&] { return stopping || queued; });
+            if (!queued) break;
+            std::unique_ptr<UploadJob> job = std::move(queued);
+            lock.unlock();
+
+            RenderBuffers& buffers = job->buffers;
+            glGenBuffers(1, &buffers.VBO);
+            glGenBuffers(1, &buffers.smoothEBO);
+            glGenBuffers(1, &buffers.flatEBO);
+            if (buffers.format == VERTEX_FLOAT) {
+                uploadInChunks(buffers.VBO, job->vertices.data(), job->vertices.size() * sizeof(Vertex));
+            }
+            else {
+                uploadInChunks(buffers.VBO, job->compactVertices.data(), job->compactVertices.size() * sizeof(CompactVertex));
+            }
+            uploadInChunks(buffers.smoothEBO, job->smoothIndices.data(), job->smoothIndices.size() * sizeof(unsigned int));
+            uploadInChunks(buffers.flatEBO, job->flatIndices.data(), job->flatIndices.size() * sizeof(unsigned int));
+            job->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+
+            lock.lock();
+            uploaded = std::move(job);
+        }
+        glfwMakeContextCurrent(NULL);
+    }
+};
+
+// Swap in buffers finished by the uploader: build their VAOs on this context,
+// delete the previous buffers and give the render data back to the globals
+void installUploadedBuffers(UploadJob& job, RenderBuffers& buffers) {
+    RenderBuffers newBuffers = job.buffers;
+    glGenVertexArrays(1, &newBuffers.smoothVAO);
+    glGenVertexArrays(1, &newBuffers.flatVAO);
+    configureVertexArrays(newBuffers);
+    deleteRenderBuffers(buffers);
+    buffers = newBuffers;
+
+    vertices.swap(job.vertices);
+    compactVertices.swap(job.compactVertices);
+    smoothIndices.swap(job.smoothIndices);
+    flatIndices.swap(job.flatIndices);
 }
-)";
 
-const char* gouraudVertexShaderSource = R"(
-#version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+// Ring buffer for data the CPU writes every frame. Each frame writes into its
+// own region through unsynchronized mappings, and a fence placed when the
+// frame ends guards the region until the GPU is done with it; a write only
+// waits when the CPU is more than framesInFlight frames ahead of the GPU.
+const size_t STREAM_REGION_BYTES = 4 << 20;
+const unsigned int STREAM_FRAMES_IN_FLIGHT = 3;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+struct StreamBuffer {
+    unsigned int buffer = 0;
+    size_t regionSize = 0;
+    std::vector<GLsync> fences;       // one per region, null when unused
+    unsigned int region = 0;
+    size_t used = 0;                  // bytes written to the current region
+    size_t waitCount = 0;             // writes that had to wait for the GPU
 
-uniform vec3 lightPos1;
-uniform vec3 lightPos2;
-uniform vec3 viewPos;
+    void create(size_t bytesPerFrame, unsigned int framesInFlight) {
+        regionSize = bytesPerFrame;
+        fences.assign(framesInFlight, nullptr);
+        glGenBuffers(1, &buffer);
+        glState.bindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glBufferData(GL_COPY_READ_BUFFER, regionSize * framesInFlight, NULL, GL_STREAM_DRAW);
+    }
 
-uniform vec4 material_ambient;
-uniform vec4 material_diffuse;
-uniform vec4 material_specular;
-uniform float material_shininess;
+    void destroy() {
+        for (GLsync& fence : fences) {
+            if (fence) glDeleteSync(fence);
+            fence = nullptr;
+        }
+        glState.deleteBuffers(1, &buffer);
+        buffer = 0;
+    }
 
-uniform vec4 light_ambient;
-uniform vec4 light_diffuse;
-uniform vec4 light_specular;
+    // Copy data into the current frame's region and return its offset in
+    // the buffer; false when it does not fit in what is left of the region
+    bool write(const void* data, size_t bytes, size_t& offset) {
+        if (buffer == 0 || used + bytes > regionSize) {
+            return false;
+        }
+        if (used == 0 && fences[region]) {
+            // The region was last written framesInFlight frames ago
+            if (glClientWaitSync(fences[region], 0, 0) == GL_TIMEOUT_EXPIRED) {
+                waitCount++;
+                while (glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+                }
+            }
+            glDeleteSync(fences[region]);
+            fences[region] = nullptr;
+        }
 
-out vec4 vertexColor;
+        offset = region * regionSize + used;
+        glState.bindBuffer(GL_COPY_READ_BUFFER, buffer);
+        void* target = glMapBufferRange(GL_COPY_READ_BUFFER, offset, bytes,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (!target) {
+            return false;
+        }
+        memcpy(target, data, bytes);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        used += (bytes + 15) & ~(size_t)15;
+        return true;
+    }
 
-void main()
-{
-    vec3 FragPos = vec3(model * vec4(aPos, 1.0));
-    vec3 Normal = mat3(transpose(inverse(model))) * aNormal;
-    Normal = normalize(Normal);
-    
-    vec3 viewDir = normalize(viewPos - FragPos);
-    
-    // Ambient
-    vec4 ambient = light_ambient * material_ambient;
-    
-    vec4 totalDiffuse = vec4(0.0);
-    vec4 totalSpecular = vec4(0.0);
-    
-    // Light 1 (object space)
-    vec3 lightDir1 = normalize(lightPos1 - FragPos);
-    float diff1 = max(dot(Normal, lightDir1), 0.0);
-    vec4 diffuse1 = light_diffuse * (diff1 * material_diffuse);
-    
-    vec3 reflectDir1 = reflect(-lightDir1, Normal);
-    float spec1 = pow(max(dot(viewDir, reflectDir1), 0.0), material_shininess);
-    vec4 specular1 = light_specular * (spec1 * material_specular);
-    
-    // Light 2 (camera space)
-    vec3 lightDir2 = normalize(lightPos2 - FragPos);
-    float diff2 = max(dot(Normal, lightDir2), 0.0);
-    vec4 diffuse2 = light_diffuse * (diff2 * material_diffuse);
-    
-    vec3 reflectDir2 = reflect(-lightDir2, Normal);
-    float spec2 = pow(max(dot(viewDir, reflectDir2), 0.0), material_shininess);
-    vec4 specular2 = light_specular * (spec2 * material_specular);
-    
-    totalDiffuse = diffuse1 + diffuse2;
-    totalSpecular = specular1 + specular2;
-    
-    vertexColor = ambient + totalDiffuse + totalSpecular;
-    gl_Position = projection * view * vec4(FragPos, 1.0);
-}
-)";
+    // Fence everything issued this frame and move on to the next region
+    void endFrame() {
+        if (used == 0) return;
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        region = (region + 1) % fences.size();
+        used = 0;
+    }
+};
 
-const char* gouraudFragmentShaderSource = R"(
-#version 330 core
-in vec4 vertexColor;
-out vec4 FragColor;
+StreamBuffer uploadStream;
 
-void main()
-{
-    FragColor = vertexColor;
+// Update part of a buffer the GPU may still be drawing from. The data is
+// staged in the stream buffer and copied on the GPU, which keeps the copy in
+// order with the draws instead of making the driver synchronize; data that
+// does not fit in this frame's region goes through glBufferSubData.
+void streamBufferSubData(unsigned int destination, size_t offset, const void* data, size_t bytes) {
+    size_t staged;
+    if (uploadStream.write(data, bytes, staged)) {
+        glState.bindBuffer(GL_COPY_READ_BUFFER, uploadStream.buffer);
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, destination);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, staged, offset, bytes);
+    }
+    else {
+        glState.bindBuffer(GL_ARRAY_BUFFER, destination);
+        glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, data);
+    }
 }
-)";
 
-const char* phongVertexShaderSource = R"(
-#version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+// Upload only the vertex runs that differ between the old and new contents
+// of a buffer with identical layout. Runs separated by fewer than mergeGap
+// unchanged vertices are merged to keep the number of calls small.
+template <typename VertexType>
+size_t uploadChangedRanges(unsigned int VBO, const std::vector<VertexType>& oldData, const std::vector<VertexType>& newData,
+    size_t& rangeCount) {
+    const size_t mergeGap = 64;
+    size_t uploadedBytes = 0;
+    rangeCount = 0;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+    size_t i = 0;
+    while (i < newData.size()) {
+        if (memcmp(&oldData[i], &newData[i], sizeof(VertexType)) == 0) {
+            i++;
+            continue;
+        }
 
-out vec3 FragPos;
-out vec3 Normal;
+        size_t first = i, last = i;
+        for (size_t j = i + 1; j < newData.size() && j - last <= mergeGap; j++) {
+            if (memcmp(&oldData[j], &newData[j], sizeof(VertexType)) != 0) last = j;
+        }
 
-void main()
-{
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+        size_t bytes = (last - first + 1) * sizeof(VertexType);
+        streamBufferSubData(VBO, first * sizeof(VertexType), &newData[first], bytes);
+        uploadedBytes += bytes;
+        rangeCount++;
+        i = last + 1;
+    }
+    return uploadedBytes;
 }
-)";
 
-const char* phongFragmentShaderSource = R"(
-#version 330 core
-in vec3 FragPos;
-in vec3 Normal;
-out vec4 FragColor;
-
-uniform vec3 lightPos1;
-uniform vec3 lightPos2;
-uniform vec3 viewPos;
+// Refresh the render vertices of the given model vertices, duplicates
+// included, and upload them, merging runs like uploadChangedRanges. A compact
+// vertex moved out of the quantization box re-encodes the whole buffer.
+size_t uploadVertexRanges(unsigned int VBO, const std::vector<unsigned int>& changedVertices, size_t& rangeCount) {
+    const size_t mergeGap = 64;
+    size_t uploadedBytes = 0;
+    rangeCount = 0;
 
-uniform vec4 material_ambient;
-uniform vec4 material_diffuse;
-uniform vec4 material_specular;
-uniform float material_shininess;
+    bool useFaceColors = renderUsesFaceColors();
+    bool compact = vertexFormat != VERTEX_FLOAT;
+    std::vector<unsigned int> slots;
+    slots.reserve(changedVertices.size());
+    for (unsigned int v : changedVertices) {
+        for (unsigned int slot = v; slot != NO_FACE; slot = renderLayout.nextDuplicate[slot]) {
+            Vertex vertex = renderVertex(slot, useFaceColors);
+            if (!compact) {
+                vertices[slot] = vertex;
+            }
+            else if (insideQuantizationBox(vertex.position)) {
+                compactVertices[slot] = compactVertex(vertex);
+            }
+            else {
+                prepareVertexData();
+                streamBufferSubData(VBO, 0, compactVertices.data(), renderVertexBytes());
+                rangeCount = 1;
+                return renderVertexBytes();
+            }
+            slots.push_back(slot);
+        }
+    }
+    std::sort(slots.begin(), slots.end());
 
-uniform vec4 light_ambient;
-uniform vec4 light_diffuse;
-uniform vec4 light_specular;
+    const unsigned char* data = compact ? (const unsigned char*)compactVertices.data() : (const unsigned char*)vertices.data();
+    size_t stride = compact ? sizeof(CompactVertex) : sizeof(Vertex);
+    size_t i = 0;
+    while (i < slots.size()) {
+        size_t j = i;
+        while (j + 1 < slots.size() && slots[j + 1] - slots[j] <= mergeGap) j++;
 
-void main()
-{
-    vec3 norm = normalize(Normal);
-    vec3 viewDir = normalize(viewPos - FragPos);
-    
-    // Ambient
-    vec4 ambient = light_ambient * material_ambient;
-    
-    vec4 totalDiffuse = vec4(0.0);
-    vec4 totalSpecular = vec4(0.0);
-    
-    // Light 1
-    vec3 lightDir1 = normalize(lightPos1 - FragPos);
-    float diff1 = max(dot(norm, lightDir1), 0.0);
-    vec4 diffuse1 = light_diffuse * (diff1 * material_diffuse);
-    
-    vec3 reflectDir1 = reflect(-lightDir1, norm);
-    float spec1 = pow(max(dot(viewDir, reflectDir1), 0.0), material_shininess);
-    vec4 specular1 = light_specular * (spec1 * material_specular);
-    
-    // Light 2
-    vec3 lightDir2 = normalize(lightPos2 - FragPos);
-    float diff2 = max(dot(norm, lightDir2), 0.0);
-    vec4 diffuse2 = light_diffuse * (diff2 * material_diffuse);
-    
-    vec3 reflectDir2 = reflect(-lightDir2, norm);
-    float spec2 = pow(max(dot(viewDir, reflectDir2), 0.0), material_shininess);
-    vec4 specular2 = light_specular * (spec2 * material_specular);
-    
-    totalDiffuse = diffuse1 + diffuse2;
-    totalSpecular = specular1 + specular2;
-    
-    FragColor = ambient + totalDiffuse + totalSpecular;
+        size_t bytes = (slots[j] - slots[i] + 1) * stride;
+        streamBufferSubData(VBO, slots[i] * stride, data + slots[i] * stride, bytes);
+        uploadedBytes += bytes;
+        rangeCount++;
+        i = j + 1;
+    }
+    return uploadedBytes;
 }
-)";
 
-// Function to compile shader
-unsigned int compileShader(const char* source, GLenum type) {
-    unsigned int shader = glCreateShader(type);
-    glShaderSource(shader, 1, &source, NULL);
-    glCompileShader(shader);
+// Sculpt brush: push the vertices within radius of a seed vertex along their
+// normals with a smooth falloff. The patch is found by walking the adjacency
+// outwards from the seed, so only the edited region is visited.
+void sculptPatch(unsigned int seed, float radius, float strength, std::vector<unsigned int>& dirtyVertices) {
+    ensureVertexAdjacency();
+    ensureVertexNormals();
+    dirtyVertices.clear();
+    std::unordered_set<unsigned int> visited = { seed };
+    std::vector<unsigned int> frontier = { seed };
+    glm::vec3 center = vertexPositions[seed];
 
-    int success;
-    char infoLog[512];
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(shader, 512, NULL, infoLog);
-        std::cerr << "Shader compilation failed: " << infoLog << std::endl;
+    while (!frontier.empty()) {
+        unsigned int v = frontier.back();
+        frontier.pop_back();
+        dirtyVertices.push_back(v);
+        for (size_t k = vertexAdjacency.offsets[v]; k < vertexAdjacency.offsets[v + 1]; k++) {
+            const Triangle& tri = triangles[vertexAdjacency.corners[k] / 3];
+            for (unsigned int w : tri.indices) {
+                if (glm::distance(vertexPositions[w], center) <= radius && visited.insert(w).second) {
+                    frontier.push_back(w);
+                }
+            }
+        }
+    }
+
+    // Displace after the walk so distances are measured on the original shape
+    for (unsigned int v : dirtyVertices) {
+        float falloff = 1.0f - glm::distance(vertexPositions[v], center) / radius;
+        glm::vec3 normal = vertexNormals[v];
+        if (std::isfinite(normal.x)) {
+            vertexPositions[v] += normal * (strength * falloff * falloff);
+        }
     }
-    return shader;
 }
 
-// Function to create shader program
-unsigned int createShaderProgram(const char* vertexSource, const char* fragmentSource) {
-    unsigned int vertexShader = compileShader(vertexSource, GL_VERTEX_SHADER);
-    unsigned int fragmentShader = compileShader(fragmentSource, GL_FRAGMENT_SHADER);
+// Buffer object exposed to shaders as a texture buffer of the given format
+unsigned int createTextureBuffer(GLenum format, const void* data, size_t bytes, unsigned int& buffer) {
+    unsigned int texture;
+    glGenBuffers(1, &buffer);
+    glState.bindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, bytes, data, GL_STATIC_DRAW);
+    glGenTextures(1, &texture);
+    glState.bindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    return texture;
+}
 
-    unsigned int program = glCreateProgram();
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
-    glLinkProgram(program);
+// Run one transform feedback pass over count points into a new buffer of
+// count records
+unsigned int runNormalPass(unsigned int program, size_t count, size_t recordSize) {
+    unsigned int output;
+    glGenBuffers(1, &output);
+    glState.bindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, output);
+    glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, count * recordSize, NULL, GL_STATIC_COPY);
+    glState.bindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, output);
 
-    int success;
-    char infoLog[512];
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(program, 512, NULL, infoLog);
-        std::cerr << "Program linking failed: " << infoLog << std::endl;
-    }
+    glState.useProgram(program);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, (GLsizei)count);
+    glEndTransformFeedback();
+    glState.bindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    return output;
+}
 
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+// Texture buffer over an existing buffer object
+unsigned int createTextureView(GLenum format, unsigned int buffer) {
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glState.bindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    return texture;
+}
 
-    return program;
+// Normals the loader left for the GPU are generated once the render buffers
+// are uploaded. A mesh the passes cannot address through texture buffers,
+// render vertices included (at most one duplicate slot per face), gets CPU
+// normals now instead.
+void completePendingNormals() {
+    if (!normalsPending) {
+        return;
+    }
+    ensureVertexAdjacency();
+    int maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    size_t slotBound = vertexPositions.size() + triangles.size();
+    size_t renderWords = slotBound * (vertexFormat == VERTEX_FLOAT ? sizeof(Vertex) : sizeof(CompactVertex)) / sizeof(uint32_t);
+    size_t largest = std::max({ vertexPositions.size() * 3, triangles.size() * 6, vertexAdjacency.corners.size(), renderWords });
+    if (largest > (size_t)maxTexels || vertexAdjacency.corners.size() > UINT32_MAX) {
+        std::cerr << "Mesh exceeds GL_MAX_TEXTURE_BUFFER_SIZE (" << maxTexels << "), generating normals on the CPU" << std::endl;
+        normalsPending = false;
+        calculateFaceNormals();
+        calculateVertexNormals();
+    }
 }
 
-// Load SMF file
-bool loadSMF(const std::string& filename) {
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        std::cerr << "Failed to open file: " << filename << std::endl;
-        return false;
+// Generate face and vertex normals of the current model on the GPU and write
+// them straight into its uploaded render vertices: a last pass over the
+// layout slots copies each render vertex with its normals filled in, into a
+// new buffer that replaces the vertex buffer. Nothing is read back except
+// for --gpu-normals=validate; the CPU copies are only computed when
+// sculpting needs them (ensureVertexNormals).
+void generateNormalsGPU(RenderBuffers& buffers, const NormalPrograms& programs) {
+    if (!normalsPending) {
+        return;
     }
+    normalsPending = false;
+    auto startTime = std::chrono::steady_clock::now();
+    ensureVertexAdjacency();
 
-    vertexPositions.clear();
-    triangles.clear();
+    static_assert(sizeof(Triangle) == 6 * sizeof(uint32_t), "the GPU normal shaders read Triangle as 6 uints");
+    std::vector<uint32_t> offsets(vertexAdjacency.offsets.begin(), vertexAdjacency.offsets.end());
+    unsigned int passBuffers[8], textures[9];
+    textures[0] = createTextureBuffer(GL_R32F, vertexPositions.data(), vertexPositions.size() * sizeof(glm::vec3), passBuffers[0]);
+    textures[1] = createTextureBuffer(GL_R32UI, triangles.data(), triangles.size() * sizeof(Triangle), passBuffers[1]);
+    textures[2] = createTextureBuffer(GL_R32UI, offsets.data(), offsets.size() * sizeof(uint32_t), passBuffers[2]);
+    textures[3] = createTextureBuffer(GL_R32UI, vertexAdjacency.corners.data(),
+        vertexAdjacency.corners.size() * sizeof(unsigned int), passBuffers[3]);
 
-    std::string line;
-    while (std::getline(file, line)) {
-        std::istringstream iss(line);
-        char type;
-        iss >> type;
+    // The passes read no vertex attributes, but the core profile still needs a VAO
+    unsigned int emptyVAO;
+    glGenVertexArrays(1, &emptyVAO);
+    glState.bindVertexArray(emptyVAO);
 
-        if (type == 'v') {
-            float x, y, z;
-            iss >> x >> y >> z;
-            vertexPositions.push_back(glm::vec3(x, y, z));
-        }
-        else if (type == 'f') {
-            Triangle tri;
-            iss >> tri.indices[0] >> tri.indices[1] >> tri.indices[2];
-            tri.indices[0]--; tri.indices[1]--; tri.indices[2]--;
-            triangles.push_back(tri);
-        }
+    // Texture units: 0 positions, 1 triangles, 2 offsets, 3 corners, 4 face
+    // normals, 5 vertex normals; the render pass reuses 0-2
+    for (int unit = 0; unit < 4; unit++) {
+        glState.activeTexture(unit);
+        glState.bindTexture(GL_TEXTURE_BUFFER, textures[unit]);
     }
+    glState.enable(GL_RASTERIZER_DISCARD);
 
-    file.close();
+    glState.useProgram(programs.face);
+    glUniform1i(glGetUniformLocation(programs.face, "positions"), 0);
+    glUniform1i(glGetUniformLocation(programs.face, "triangles"), 1);
+    passBuffers[4] = runNormalPass(programs.face, triangles.size(), sizeof(glm::vec3));
+    glState.activeTexture(4);
+    textures[4] = createTextureView(GL_R32F, passBuffers[4]);
 
-    // Calculate model center
-    modelCenter = glm::vec3(0.0f);
-    for (const auto& pos : vertexPositions) {
-        modelCenter += pos;
-    }
-    modelCenter /= vertexPositions.size();
+    glState.useProgram(programs.vertex);
+    glUniform1i(glGetUniformLocation(programs.vertex, "positions"), 0);
+    glUniform1i(glGetUniformLocation(programs.vertex, "triangles"), 1);
+    glUniform1i(glGetUniformLocation(programs.vertex, "offsets"), 2);
+    glUniform1i(glGetUniformLocation(programs.vertex, "corners"), 3);
+    glUniform1i(glGetUniformLocation(programs.vertex, "faceNormals"), 4);
+    glUniform1i(glGetUniformLocation(programs.vertex, "weighting"), (int)normalWeighting);
+    passBuffers[5] = runNormalPass(programs.vertex, vertexPositions.size(), sizeof(glm::vec3));
+    glState.activeTexture(5);
+    textures[5] = createTextureView(GL_R32F, passBuffers[5]);
 
-    std::cout << "Loaded " << vertexPositions.size() << " vertices and "
-        << triangles.size() << " triangles" << std::endl;
+    // Slot-to-vertex and slot-to-face maps of the render layout
+    size_t slotCount = renderLayout.provokedFace.size();
+    glState.activeTexture(0);
+    textures[6] = createTextureView(GL_R32UI, buffers.VBO);
+    glState.activeTexture(1);
+    textures[7] = createTextureBuffer(GL_R32UI, renderLayout.duplicateSources.data(),
+        renderLayout.duplicateSources.size() * sizeof(unsigned int), passBuffers[6]);
+    glState.activeTexture(2);
+    textures[8] = createTextureBuffer(GL_R32UI, renderLayout.provokedFace.data(),
+        slotCount * sizeof(unsigned int), passBuffers[7]);
 
-    return true;
-}
+    glState.useProgram(programs.render);
+    glUniform1i(glGetUniformLocation(programs.render, "renderVertices"), 0);
+    glUniform1i(glGetUniformLocation(programs.render, "duplicateSources"), 1);
+    glUniform1i(glGetUniformLocation(programs.render, "provokedFaces"), 2);
+    glUniform1i(glGetUniformLocation(programs.render, "faceNormals"), 4);
+    glUniform1i(glGetUniformLocation(programs.render, "vertexNormals"), 5);
+    glUniform1i(glGetUniformLocation(programs.render, "vertexCount"), (int)vertexPositions.size());
+    glUniform1i(glGetUniformLocation(programs.render, "format"), (int)buffers.format);
+    size_t vertexSize = buffers.format == VERTEX_FLOAT ? sizeof(Vertex) : sizeof(CompactVertex);
+    unsigned int renderVertexBuffer = runNormalPass(programs.render, slotCount, vertexSize);
 
-// Calculate face normals
-void calculateFaceNormals() {
-    for (auto& tri : triangles) {
-        glm::vec3 v0 = vertexPositions[tri.indices[0]];
-        glm::vec3 v1 = vertexPositions[tri.indices[1]];
-        glm::vec3 v2 = vertexPositions[tri.indices[2]];
+    glState.disable(GL_RASTERIZER_DISCARD);
+    glState.activeTexture(0);
+    glState.deleteVertexArrays(1, &emptyVAO);
+    glState.deleteTextures(9, textures);
 
-        glm::vec3 edge1 = v1 - v0;
-        glm::vec3 edge2 = v2 - v0;
-        tri.faceNormal = glm::normalize(glm::cross(edge1, edge2));
-    }
-}
+    glState.deleteBuffers(1, &buffers.VBO);
+    buffers.VBO = renderVertexBuffer;
+    configureVertexArrays(buffers);
 
-// Calculate vertex normals (average of adjacent face normals)
-void calculateVertexNormals() {
-    vertexNormals.resize(vertexPositions.size(), glm::vec3(0.0f));
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Generated normals on the GPU into the vertex buffer, submitted in " << seconds * 1000.0 << " ms" << std::endl;
 
-    for (const auto& tri : triangles) {
-        vertexNormals[tri.indices[0]] += tri.faceNormal;
-        vertexNormals[tri.indices[1]] += tri.faceNormal;
-        vertexNormals[tri.indices[2]] += tri.faceNormal;
-    }
+    if (validateGpuNormals) {
+        std::vector<glm::vec3> gpuFaceNormals(triangles.size()), gpuNormals(vertexPositions.size());
+        glState.bindBuffer(GL_ARRAY_BUFFER, passBuffers[4]);
+        glGetBufferSubData(GL_ARRAY_BUFFER, 0, gpuFaceNormals.size() * sizeof(glm::vec3), gpuFaceNormals.data());
+        glState.bindBuffer(GL_ARRAY_BUFFER, passBuffers[5]);
+        glGetBufferSubData(GL_ARRAY_BUFFER, 0, gpuNormals.size() * sizeof(glm::vec3), gpuNormals.data());
+
+        std::vector<Triangle> cpuTriangles = triangles;
+        std::vector<glm::vec3> cpuNormals;
+        calculateFaceNormals(vertexPositions, cpuTriangles);
+        calculateVertexNormals(vertexPositions, cpuTriangles, vertexAdjacency, cpuNormals);
 
-    for (auto& normal : vertexNormals) {
-        normal = glm::normalize(normal);
+        // Degenerate faces and isolated vertices are NaN on the CPU and
+        // undefined on the GPU, so they are skipped
+        float maxFaceError = 0.0f, maxVertexError = 0.0f;
+        for (size_t f = 0; f < triangles.size(); f++) {
+            if (std::isfinite(cpuTriangles[f].faceNormal.x)) {
+                maxFaceError = std::max(maxFaceError, glm::length(cpuTriangles[f].faceNormal - gpuFaceNormals[f]));
+            }
+        }
+        for (size_t v = 0; v < gpuNormals.size(); v++) {
+            if (std::isfinite(cpuNormals[v].x)) {
+                maxVertexError = std::max(maxVertexError, glm::length(cpuNormals[v] - gpuNormals[v]));
+            }
+        }
+        std::cout << "GPU normals vs calculateVertexNormals: max face error " << maxFaceError
+                  << ", max vertex error " << maxVertexError
+                  << (maxFaceError < 1e-3f && maxVertexError < 1e-3f ? " (OK)" : " (MISMATCH)") << std::endl;
     }
+    glState.deleteBuffers(8, passBuffers);
 }
 
-// Prepare vertex data
-void prepareVertexData() {
-    vertices.clear();
-
-    if (shadingMode == 0) {
-        // Flat shading - use face normals
-        for (const auto& tri : triangles) {
-            for (int i = 0; i < 3; i++) {
-                Vertex v;
-                v.position = vertexPositions[tri.indices[i]];
-                v.normal = tri.faceNormal;
-                vertices.push_back(v);
-            }
+// True if both meshes have the same vertex count and triangle indices
+bool sameTopology(const MeshData& mesh) {
+    if (mesh.positions.size() != vertexPositions.size() || mesh.triangles.size() != triangles.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < triangles.size(); i++) {
+        if (memcmp(mesh.triangles[i].indices, triangles[i].indices, sizeof(triangles[i].indices)) != 0) {
+            return false;
         }
     }
-    else {
-        // Gouraud or Phong - use vertex normals
-        for (const auto& tri : triangles) {
-            for (int i = 0; i < 3; i++) {
-                Vertex v;
-                v.position = vertexPositions[tri.indices[i]];
-                v.normal = vertexNormals[tri.indices[i]];
-                vertices.push_back(v);
-            }
+    return true;
+}
+
+// Append vertices to a growing VBO, doubling its storage when it is full
+void appendStreamVertices(unsigned int VAO, unsigned int& VBO, size_t& capacity, size_t& count,
+    const std::vector<Vertex>& batch) {
+    if (count + batch.size() > capacity) {
+        size_t newCapacity = std::max(capacity * 2, count + batch.size());
+        newCapacity = std::max<size_t>(newCapacity, 1 << 16);
+
+        unsigned int newVBO;
+        glGenBuffers(1, &newVBO);
+        glState.bindBuffer(GL_COPY_WRITE_BUFFER, newVBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, newCapacity * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+        if (count > 0) {
+            glState.bindBuffer(GL_COPY_READ_BUFFER, VBO);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, count * sizeof(Vertex));
         }
+        glState.deleteBuffers(1, &VBO);
+        VBO = newVBO;
+        capacity = newCapacity;
+
+        glState.bindVertexArray(VAO);
+        glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
+        configureVertexAttributes(VERTEX_FLOAT);
     }
+
+    streamBufferSubData(VBO, count * sizeof(Vertex), batch.data(), batch.size() * sizeof(Vertex));
+    count += batch.size();
 }
 
 // Keyboard callback
@@ -430,6 +4757,12 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
             currentMaterial = (currentMaterial + 1) % 3;
             std::cout << "Material: " << currentMaterial << std::endl;
             break;
+        case GLFW_KEY_N:
+            nextModelRequested = true;
+            break;
+        case GLFW_KEY_B:
+            sculptRequested = true;
+            break;
         case GLFW_KEY_J:
             lightAngle -= 5.0f;
             break;
@@ -453,30 +4786,153 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     }
 }
 
+// Whole decimal number in an option value; false if it is empty, signed,
+// has trailing characters or does not fit
+bool parseUnsignedOption(const std::string& text, unsigned long long& value) {
+    const char* end = text.data() + text.size();
+    std::from_chars_result result = std::from_chars(text.data(), end, value);
+    return !text.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
 int main(int argc, char** argv) {
-    std::string filename;
+    std::vector<std::string> modelFiles;
+
+    // Options
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--loader=stream") {
+            useMappedLoader = false;
+        }
+        else if (arg == "--loader=mapped") {
+            useMappedLoader = true;
+        }
+        else if (arg == "--stream") {
+            useStreamingLoad = true;
+        }
+        else if (arg == "--weld") {
+            useWelding = true;
+        }
+        else if (arg.rfind("--weld=", 0) == 0) {
+            // Finite and not negative; denormals would overflow the weld cells
+            std::string text = arg.substr(7);
+            float epsilon = 0.0f;
+            std::from_chars_result result = std::from_chars(text.data(), text.data() + text.size(), epsilon);
+            if (text.empty() || result.ec != std::errc() || result.ptr != text.data() + text.size() ||
+                !std::isfinite(epsilon) || epsilon < 0.0f || (epsilon > 0.0f && epsilon < FLT_MIN)) {
+                std::cerr << "Invalid option value: " << arg << std::endl;
+            }
+            else {
+                useWelding = true;
+                weldEpsilon = epsilon;
+            }
+        }
+        else if (arg == "--reorder") {
+            useReordering = true;
+        }
+        else if (arg.rfind("--reorder=", 0) == 0) {
+            // A cache must hold at least one triangle
+            unsigned long long cacheSize;
+            if (!parseUnsignedOption(arg.substr(10), cacheSize) ||
+                cacheSize < MIN_VERTEX_CACHE_SIZE || cacheSize > MAX_VERTEX_CACHE_SIZE) {
+                std::cerr << "Invalid option value: " << arg << std::endl;
+            }
+            else {
+                useReordering = true;
+                vertexCacheSize = (unsigned int)cacheSize;
+            }
+        }
+        else if (arg.rfind("--vertex-format=", 0) == 0) {
+            std::string format = arg.substr(16);
+            if (format == "float") vertexFormat = VERTEX_FLOAT;
+            else if (format == "packed") vertexFormat = VERTEX_PACKED;
+            else if (format == "oct") vertexFormat = VERTEX_OCTAHEDRAL;
+            else std::cerr << "Invalid option value: " << arg << std::endl;
+        }
+        else if (arg.rfind("--export-smfq=", 0) == 0) {
+            quantizedExportPath = arg.substr(14);
+        }
+        else if (arg == "--no-watch") {
+            watchModelFile = false;
+        }
+        else if (arg == "--no-cache") {
+            useMeshCache = false;
+        }
+        else if (arg.rfind("--cache-dir=", 0) == 0) {
+            meshCacheDir = arg.substr(12);
+        }
+        else if (arg == "--no-shader-cache") {
+            useShaderCache = false;
+        }
+        else if (arg.rfind("--normal-weight=", 0) == 0) {
+            std::string weighting = arg.substr(16);
+            if (weighting == "uniform") normalWeighting = WEIGHT_UNIFORM;
+            else if (weighting == "area") normalWeighting = WEIGHT_AREA;
+            else if (weighting == "angle") normalWeighting = WEIGHT_ANGLE;
+            else std::cerr << "Invalid option value: " << arg << std::endl;
+        }
+        else if (arg == "--gpu-normals") {
+            useGpuNormals = true;
+        }
+        else if (arg == "--gpu-normals=validate") {
+            useGpuNormals = true;
+            validateGpuNormals = true;
+        }
+        else if (arg.rfind("--simd=", 0) == 0) {
+            std::string level = arg.substr(7);
+            if (level == "scalar") maxSimdLevel = SIMD_SCALAR;
+            else if (level == "sse") maxSimdLevel = SIMD_SSE;
+            else if (level == "avx2") maxSimdLevel = SIMD_AVX2;
+            else std::cerr << "Invalid option value: " << arg << std::endl;
+        }
+        else if (arg.rfind("--threads=", 0) == 0) {
+            unsigned long long threads;
+            if (!parseUnsignedOption(arg.substr(10), threads) || threads == 0) {
+                std::cerr << "Invalid option value: " << arg << std::endl;
+            }
+            else {
+                workerThreadCount = (unsigned int)std::min<unsigned long long>(threads, MAX_WORKER_THREADS);
+            }
+        }
+        else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "Unknown option: " << arg << std::endl;
+        }
+        else {
+            modelFiles.push_back(arg);
+        }
+    }
     
     // Если аргумент не передан, используем путь по умолчанию
-    if (argc < 2) {
-        filename = "../../models/cube.smf";
-        std::cout << "No argument provided. Using default: " << filename << std::endl;
+    if (modelFiles.empty()) {
+        modelFiles.push_back("../../models/cube.smf");
+        std::cout << "No argument provided. Using default: " << modelFiles[0] << std::endl;
     } else {
-        filename = argv[1];
-        std::cout << "Loading model: " << filename << std::endl;
+        std::cout << "Loading model: " << modelFiles[0] << std::endl;
     }
+    size_t currentModel = 0;
+    std::string filename = modelFiles[0];
     
     // Загрузка модели
-    if (!loadSMF(filename)) {
-        std::cerr << "ERROR: Failed to load model!" << std::endl;
-        std::cin.get(); // Держим консоль открытой
-        return -1;
+    bool streaming = useStreamingLoad && detectCompression(filename) == COMPRESSION_NONE && detectMeshFormat(filename) == FORMAT_SMF;
+
+    if (!streaming) {
+        MeshData mesh;
+        if (!loadMeshFile(filename, mesh)) {
+            std::cerr << "ERROR: Failed to load model!" << std::endl;
+            std::cin.get(); // Держим консоль открытой
+            return -1;
+        }
+        if (!quantizedExportPath.empty()) {
+            if (mesh.normalsPending) {
+                calculateMissingNormals(mesh);
+                mesh.normalsPending = false;
+            }
+            saveQuantizedMesh(quantizedExportPath, mesh);
+        }
+        installMesh(mesh);
+
+        std::cout << "SUCCESS! Loaded " << vertexPositions.size()
+                  << " vertices and " << triangles.size() << " triangles" << std::endl;
     }
-    
-    std::cout << "SUCCESS! Loaded " << vertexPositions.size() 
-              << " vertices and " << triangles.size() << " triangles" << std::endl;
-    
-    calculateFaceNormals();
-    calculateVertexNormals();
 
     // Initialize GLFW
     if (!glfwInit()) {
@@ -504,45 +4960,205 @@ int main(int argc, char** argv) {
         return -1;
     }
 
-    glEnable(GL_DEPTH_TEST);
+    glState.enable(GL_DEPTH_TEST);
     glViewport(0, 0, windowWidth, windowHeight);
 
     // Create shader programs
-    unsigned int flatShader = createShaderProgram(flatVertexShaderSource, flatFragmentShaderSource);
-    unsigned int gouraudShader = createShaderProgram(gouraudVertexShaderSource, gouraudFragmentShaderSource);
-    unsigned int phongShader = createShaderProgram(phongVertexShaderSource, phongFragmentShaderSource);
+    ShaderVariants shaderVariants;
+    NormalPrograms normalPrograms;
+    normalPrograms.create(vertexFormat);
+
+    // Create the model's buffers; every shading mode draws from them
+    RenderBuffers buffers;
+    createRenderBuffers(buffers);
+    uploadStream.create(STREAM_REGION_BYTES, STREAM_FRAMES_IN_FLIGHT);
+    UniformBuffer uniformBuffer;
+    uniformBuffer.create();
 
-    // Create VAO and VBO
-    unsigned int VAO, VBO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
+    // Uploads of whole models go to a thread with a shared context when
+    // one can be created; nothing is drawn until the first one is done
+    BufferUploader bufferUploader;
+    bool backgroundUpload = bufferUploader.start(window);
+    if (!backgroundUpload) {
+        std::cerr << "No shared GL context, uploading on the render thread" << std::endl;
+    }
+
+    if (!streaming) {
+        completePendingNormals();
+        prepareVertexData();
+        if (backgroundUpload) {
+            bufferUploader.submit();
+        }
+        else {
+            uploadRenderBuffers(buffers);
+            generateNormalsGPU(buffers, normalPrograms);
+        }
+    }
 
     std::cout << "\nControls:" << std::endl;
     std::cout << "Camera: A/D (rotate), W/S (height), Q/E (radius)" << std::endl;
     std::cout << "Light: J/L (rotate), I/K (height), U/O (radius)" << std::endl;
     std::cout << "P: Toggle projection, 1/2/3: Flat/Gouraud/Phong, M: Change material" << std::endl;
+    std::cout << "N: Load next model, B: Sculpt a random patch" << std::endl;
+
+    // Progressive load: faces are appended to the VBO as they are parsed
+    StreamingLoad streamingLoad;
+    size_t streamCapacity = 0;
+    size_t streamVertexCount = 0;
+    if (streaming) {
+        streamingLoad.worker = std::thread(streamSMF, &streamingLoad, filename);
+    }
 
-    int prevShadingMode = -1;
+    // Background loads and reloads; the result is swapped in at a frame boundary
+    std::unique_ptr<AsyncLoad> asyncLoad;
+    bool reloadQueued = false;
+    FileWatcher watcher;
+    if (watchModelFile) {
+        watcher.watch(filename);
+    }
 
     // Main loop
     while (!glfwWindowShouldClose(window)) {
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // Update vertex data if shading mode changed
-        if (shadingMode != prevShadingMode) {
-            prepareVertexData();
-            prevShadingMode = shadingMode;
+        // Upload faces parsed since the last frame
+        if (streaming) {
+            bool done = streamingLoad.finished;
+            std::vector<Vertex> batch;
+            {
+                std::lock_guard<std::mutex> lock(streamingLoad.mutex);
+                batch.swap(streamingLoad.pendingVertices);
+                if (streamingLoad.positionCount > 0) {
+                    modelCenter = streamingLoad.positionSum / (float)streamingLoad.positionCount;
+                }
+            }
+            if (!batch.empty()) {
+                appendStreamVertices(buffers.smoothVAO, buffers.VBO, streamCapacity, streamVertexCount, batch);
+            }
+
+            if (done) {
+                streamingLoad.worker.join();
+                streaming = false;
+                if (streamingLoad.failed) {
+                    std::cerr << "ERROR: Failed to load model!" << std::endl;
+                    break;
+                }
+
+                if (!quantizedExportPath.empty()) {
+                    saveQuantizedMesh(quantizedExportPath, streamingLoad.mesh);
+                }
+                installMesh(streamingLoad.mesh);
+                prepareVertexData();
+                uploadRenderBuffers(buffers);
+                std::cout << "SUCCESS! Loaded " << vertexPositions.size()
+                          << " vertices and " << triangles.size() << " triangles" << std::endl;
+            }
+        }
+
+        // Start background loads for model switches and on-disk changes
+        if (watchModelFile && watcher.poll()) {
+            reloadQueued = true;
+        }
+        if (nextModelRequested && modelFiles.size() > 1 && !asyncLoad && !streaming) {
+            currentModel = (currentModel + 1) % modelFiles.size();
+            filename = modelFiles[currentModel];
+            if (watchModelFile) {
+                watcher.watch(filename);
+            }
+            asyncLoad = startAsyncLoad(filename);
+            reloadQueued = false;
+        }
+        nextModelRequested = false;
+        if (reloadQueued && !asyncLoad && !streaming) {
+            asyncLoad = startAsyncLoad(filename);
+            reloadQueued = false;
+        }
+
+        // Swap in buffers finished by the uploader
+        if (std::unique_ptr<UploadJob> job = bufferUploader.take()) {
+            installUploadedBuffers(*job, buffers);
+            generateNormalsGPU(buffers, normalPrograms);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job->submitted).count();
+            std::cout << "Uploaded " << (renderVertexBytes() + (smoothIndices.size() + flatIndices.size()) * sizeof(unsigned int)) / (1024.0 * 1024.0)
+                      << " MB in the background in " << seconds * 1000.0 << " ms" << std::endl;
+        }
+
+        // Swap in a finished background load; the model being uploaded owns
+        // the render data until then
+        if (asyncLoad && asyncLoad->finished && !bufferUploader.busy) {
+            asyncLoad->worker.join();
+            if (!asyncLoad->succeeded) {
+                std::cerr << "Failed to load " << asyncLoad->filename << ", keeping the current model" << std::endl;
+            }
+            else if (asyncLoad->filename == filename && sameTopology(asyncLoad->mesh)) {
+                // Same topology: the buffer layout is unchanged, patch the differences
+                installMesh(asyncLoad->mesh);
+                completePendingNormals();
+                std::vector<Vertex> oldVertices;
+                std::vector<CompactVertex> oldCompactVertices;
+                std::vector<unsigned int> oldIndices;
+                oldVertices.swap(vertices);
+                oldCompactVertices.swap(compactVertices);
+                oldIndices.swap(smoothIndices);
+                prepareVertexData();
+
+                size_t rangeCount;
+                size_t bytes = vertexFormat == VERTEX_FLOAT ?
+                    uploadChangedRanges(buffers.VBO, oldVertices, vertices, rangeCount) :
+                    uploadChangedRanges(buffers.VBO, oldCompactVertices, compactVertices, rangeCount);
+                if (smoothIndices != oldIndices) {
+                    // Face colors appeared or went away, which changes the smooth order
+                    glState.bindVertexArray(buffers.smoothVAO);
+                    glBufferData(GL_ELEMENT_ARRAY_BUFFER, smoothIndices.size() * sizeof(unsigned int), smoothIndices.data(), GL_STATIC_DRAW);
+                    glState.bindVertexArray(0);
+                    bytes += smoothIndices.size() * sizeof(unsigned int);
+                }
+                describeRenderBuffers(buffers);
+                generateNormalsGPU(buffers, normalPrograms);
+                std::cout << "Reloaded " << filename << ": patched " << rangeCount << " ranges ("
+                          << bytes << " of " << renderVertexBytes() << " bytes)" << std::endl;
+            }
+            else {
+                // Build the new buffers completely, then swap the handles; the
+                // current ones keep being drawn meanwhile
+                installMesh(asyncLoad->mesh);
+                completePendingNormals();
+                prepareVertexData();
+
+                if (backgroundUpload) {
+                    bufferUploader.submit();
+                }
+                else {
+                    RenderBuffers newBuffers;
+                    createRenderBuffers(newBuffers);
+                    uploadRenderBuffers(newBuffers);
+                    deleteRenderBuffers(buffers);
+                    buffers = newBuffers;
+                    generateNormalsGPU(buffers, normalPrograms);
+                }
+                std::cout << "Switched to " << asyncLoad->filename << ": " << vertexPositions.size()
+                          << " vertices and " << triangles.size() << " triangles" << std::endl;
+            }
+            asyncLoad.reset();
+        }
 
-            glBindVertexArray(VAO);
-            glBindBuffer(GL_ARRAY_BUFFER, VBO);
-            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+        // Sculpt a random patch and refresh only the normals and vertices it touches
+        if (sculptRequested && !streaming && !bufferUploader.busy && !vertexPositions.empty()) {
+            auto startTime = std::chrono::steady_clock::now();
+            float diagonal = glm::length(modelBoundsMax - modelBoundsMin);
+            std::vector<unsigned int> dirtyVertices, changedVertices;
+            sculptPatch((unsigned int)(rand() % vertexPositions.size()), 0.1f * diagonal, 0.02f * diagonal, dirtyVertices);
+            updateNormalsIncremental(dirtyVertices, changedVertices);
 
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-            glEnableVertexAttribArray(0);
-            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
-            glEnableVertexAttribArray(1);
+            size_t rangeCount;
+            size_t bytes = uploadVertexRanges(buffers.VBO, changedVertices, rangeCount);
+            describeRenderBuffers(buffers);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+            std::cout << "Sculpted " << dirtyVertices.size() << " vertices in " << seconds * 1000.0 << " ms: uploaded "
+                      << rangeCount << " ranges (" << bytes << " of " << renderVertexBytes() << " bytes)" << std::endl;
         }
+        sculptRequested = false;
 
         // Calculate camera position
         float radAngle = glm::radians(cameraAngle);
@@ -575,83 +5191,89 @@ int main(int argc, char** argv) {
             projection = glm::ortho(-orthoSize, orthoSize, -orthoSize, orthoSize, 0.1f, 100.0f);
         }
 
-        // Select shader
-        unsigned int currentShader;
-        if (shadingMode == 0) {
-            currentShader = flatShader;
-        }
-        else if (shadingMode == 1) {
-            currentShader = gouraudShader;
-        }
-        else {
-            currentShader = phongShader;
-        }
-
-        glUseProgram(currentShader);
-
-        // Set uniforms
-        glUniformMatrix4fv(glGetUniformLocation(currentShader, "model"), 1, GL_FALSE, glm::value_ptr(model));
-        glUniformMatrix4fv(glGetUniformLocation(currentShader, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(currentShader, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        // Frame, light and material blocks, shared by all programs
+        FrameBlock frame;
+        frame.view = view;
+        frame.projection = projection;
+        frame.viewProjection = projection * view;
+        frame.model = model;
+        frame.modelViewProjection = frame.viewProjection * model;
+        frame.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model))));
+        frame.viewPos = glm::vec4(cameraPos, 1.0f);
 
-        if (shadingMode > 0) {
-            // Material properties
-            glm::vec4 mat_ambient, mat_diffuse, mat_specular;
-            float mat_shininess;
+        LightsBlock lights = {};
+        lights.positions[0] = glm::vec4(lightPos1, 1.0f);
+        lights.positions[1] = glm::vec4(lightPos2, 1.0f);
+        lights.ambient = glm::vec4(0.2f, 0.2f, 0.2f, 1.0f);
+        lights.diffuse = glm::vec4(0.6f, 0.6f, 0.6f, 1.0f);
+        lights.specular = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
 
-            if (currentMaterial == 0) {
-                // Bright specular material (required)
-                mat_ambient = glm::vec4(0.6f, 0.2f, 0.2f, 1.0f);
-                mat_diffuse = glm::vec4(0.9f, 0.1f, 0.1f, 1.0f);
-                mat_specular = glm::vec4(0.8f, 0.8f, 0.8f, 1.0f);
-                mat_shininess = 80.0f;
-            }
-            else if (currentMaterial == 1) {
-                // Gold-like material
-                mat_ambient = glm::vec4(0.24725f, 0.1995f, 0.0745f, 1.0f);
-                mat_diffuse = glm::vec4(0.75164f, 0.60648f, 0.22648f, 1.0f);
-                mat_specular = glm::vec4(0.628281f, 0.555802f, 0.366065f, 1.0f);
-                mat_shininess = 51.2f;
-            }
-            else {
-                // Emerald-like material
-                mat_ambient = glm::vec4(0.0215f, 0.1745f, 0.0215f, 1.0f);
-                mat_diffuse = glm::vec4(0.07568f, 0.61424f, 0.07568f, 1.0f);
-                mat_specular = glm::vec4(0.633f, 0.727811f, 0.633f, 1.0f);
-                mat_shininess = 76.8f;
-            }
+        uniformBuffer.update(frame, lights, materials[currentMaterial]);
 
-            glm::vec4 light_ambient(0.2f, 0.2f, 0.2f, 1.0f);
-            glm::vec4 light_diffuse(0.6f, 0.6f, 0.6f, 1.0f);
-            glm::vec4 light_specular(1.0f, 1.0f, 1.0f, 1.0f);
-
-            glUniform3fv(glGetUniformLocation(currentShader, "lightPos1"), 1, glm::value_ptr(lightPos1));
-            glUniform3fv(glGetUniformLocation(currentShader, "lightPos2"), 1, glm::value_ptr(lightPos2));
-            glUniform3fv(glGetUniformLocation(currentShader, "viewPos"), 1, glm::value_ptr(cameraPos));
+        // Select the shader variant. Colors and decoding follow the buffers
+        // being drawn, which may still hold the previous model during a
+        // background upload; the streamed preview is float and uncolored
+        ShadingModel shading = streaming ? SHADING_FLAT : (ShadingModel)shadingMode;
+        VertexFormat format = streaming ? VERTEX_FLOAT : buffers.format;
+        ColorSource color = COLOR_NONE;
+        if (!streaming && buffers.useVertexColor) {
+            color = buffers.useFaceColor ? COLOR_FACE : COLOR_VERTEX;
+        }
+        ShaderProgram& currentShader = shaderVariants.get(ShaderKey(shading, SCENE_LIGHT_COUNT, format, color));
+        glState.useProgram(currentShader.id);
 
-            glUniform4fv(glGetUniformLocation(currentShader, "material_ambient"), 1, glm::value_ptr(mat_ambient));
-            glUniform4fv(glGetUniformLocation(currentShader, "material_diffuse"), 1, glm::value_ptr(mat_diffuse));
-            glUniform4fv(glGetUniformLocation(currentShader, "material_specular"), 1, glm::value_ptr(mat_specular));
-            glUniform1f(glGetUniformLocation(currentShader, "material_shininess"), mat_shininess);
+        // Only compact variants have the quantization box uniforms
+        currentShader.setVec3(UNIFORM_POSITION_OFFSET, buffers.positionOffset);
+        currentShader.setVec3(UNIFORM_POSITION_SCALE, buffers.positionScale);
 
-            glUniform4fv(glGetUniformLocation(currentShader, "light_ambient"), 1, glm::value_ptr(light_ambient));
-            glUniform4fv(glGetUniformLocation(currentShader, "light_diffuse"), 1, glm::value_ptr(light_diffuse));
-            glUniform4fv(glGetUniformLocation(currentShader, "light_specular"), 1, glm::value_ptr(light_specular));
+        // Draw: streamed faces are still de-indexed, the finished model is indexed
+        if (streaming) {
+            glState.bindVertexArray(buffers.smoothVAO);
+            glDrawArrays(GL_TRIANGLES, 0, streamVertexCount);
         }
-
-        // Draw
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLES, 0, vertices.size());
+        else if (shadingMode == 0) {
+            glState.bindVertexArray(buffers.flatVAO);
+            glDrawElements(GL_TRIANGLES, (GLsizei)buffers.flatCount, GL_UNSIGNED_INT, 0);
+        }
+        else {
+            glState.bindVertexArray(buffers.smoothVAO);
+            glDrawElements(GL_TRIANGLES, (GLsizei)buffers.smoothCount, GL_UNSIGNED_INT, 0);
+        }
+        uploadStream.endFrame();
+        glState.endFrame();
 
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteProgram(flatShader);
-    glDeleteProgram(gouraudShader);
-    glDeleteProgram(phongShader);
+    if (streamingLoad.worker.joinable()) {
+        streamingLoad.cancelled = true;
+        streamingLoad.worker.join();
+    }
+    if (asyncLoad) {
+        asyncLoad->worker.join();
+    }
+
+    bufferUploader.stop();
+    deleteRenderBuffers(buffers);
+    if (uploadStream.waitCount > 0) {
+        std::cout << "Stream buffer: " << uploadStream.waitCount << " writes waited for the GPU" << std::endl;
+    }
+    uploadStream.destroy();
+
+    size_t issuedUniformCalls = uniformBuffer.issuedCalls;
+    size_t avoidedUniformCalls = uniformBuffer.avoidedCalls;
+    for (auto& entry : shaderVariants.programs) {
+        issuedUniformCalls += entry.second.issuedCalls;
+        avoidedUniformCalls += entry.second.avoidedCalls;
+    }
+    shaderVariants.destroy();
+    std::cout << "GL state calls: " << glState.totalIssued << " issued, " << glState.totalFiltered
+              << " filtered as redundant (last frame " << glState.lastIssued << " / " << glState.lastFiltered << ")" << std::endl;
+    std::cout << "Uniform updates: " << issuedUniformCalls << " sent, " << avoidedUniformCalls
+              << " skipped as unchanged" << std::endl;
+    uniformBuffer.destroy();
+    normalPrograms.destroy();
 
     glfwTerminate();
     return 0;